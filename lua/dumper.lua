@@ -1,6 +1,7 @@
 -- As taken from: http://lua-users.org/wiki/DataDumper (10/20/2014)
 -- Modifications:
 --  - userdata variables are dumped using their __tostring() meta method.
+--  - Definition proxies are dumped like tables, using toTable().
 
 --[[ DataDumper.lua
 Copyright (c) 2007 Olivetti-Engineering SA
@@ -98,7 +99,13 @@ function DataDumper(value, varname, fastmode, ident)
     ['function'] = function(value) 
       return string_format("loadstring(%q)", string_dump(value)) 
     end,
-    userdata = function(value) return strvalcache[tostring(value)] end,
+    userdata = function(value, ident, path)
+      if toTable then
+        local t = toTable(value)
+        if t ~= value then return dumplua(t, ident, path) end
+      end
+      return strvalcache[tostring(value)]
+    end,
     thread = function() error("Cannot dump threads") end,
   }
   local function test_defined(value, path)
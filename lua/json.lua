@@ -56,9 +56,12 @@ end
 function enumsToJson(enums)
 	local r = {}
 	for k, v in pairs (enums) do
+		local values = {}
+		for name, value in pairs (v.elements) do values[name] = value end
+		
 		r[v.name] = {
 			annotations = annotationsToJson (v.annotations),
-			values = onEach (v.elements, function (c) return tonumber(c) end)
+			values = values
 		}
 	end
 	return r
@@ -95,7 +98,7 @@ end
 
 function fileToJson(file)
 	local r = {}
-	for k, v in pairs (findAll (definitions.classes, 'file', file)) do
+	for k, v in ipairs (definitions.index.byFile[file] or {}) do
 		r[v.name] = classToJson (v)
 	end
 	
@@ -126,8 +126,8 @@ end
 
 function shouldDeclareMetatype(name)
 	if not name then return false end
-	if table.containsValue (definitions.declaredTypes, name) or
-	   table.containsValue (definitions.avoidedTypes, name) then
+	if definitions.declaredTypeSet[name] or
+	   definitions.avoidedTypeSet[name] then
 		return false
 	end
 	return true
@@ -149,6 +149,7 @@ function writeDeclareMetatype(name, fullyDeclared)
 	end
 	
 	table.insert (definitions.declaredTypes, name)
+	definitions.declaredTypeSet[name] = true
 	write (macro .. "(" .. name .. ")\n")
 end
 
@@ -165,7 +166,7 @@ function classMetaTypeId(class, asPointer)
 	if asPointer then return "qMetaTypeId< " .. class.name .. " * > ()" end
 	
 	if class.hasValueSemantics and
-	   not table.containsValue (definitions.avoidedTypes, class.name) then
+	   not definitions.avoidedTypeSet[class.name] then
 		return "qMetaTypeId< " .. class.name .. " > ()"
 	else
 		return "0"
@@ -182,8 +183,8 @@ function converterName(conv)
 end
 
 function writeMemberConverter(conv)
-	if table.containsValue (definitions.avoidedTypes, conv.fromType) or
-	   table.containsValue (definitions.avoidedTypes, conv.toType) then
+	if definitions.avoidedTypeSet[conv.fromType] or
+	   definitions.avoidedTypeSet[conv.toType] then
 		return
 	end
 	
@@ -330,7 +331,7 @@ function writeNameFunc(name, t, nameFunc)
 	local head = "  QByteArray " .. name .. " (int index) {\n"
 	local switch = indentCode (4, tableToSwitch (r, "index", false, 1)) .. "\n"
 	local foot = "    return QByteArray ();\n  }\n\n"
-	write(head .. switch .. foot)
+	write (head, switch, foot)
 end
 
 function methodTypeToCppName(type)
@@ -353,7 +354,7 @@ function writeMethodFunc(methods, prolog, default, func)
 	local head = "  " .. prolog .. " (int index) {\n"
 	local switch = indentCode (4, tableToSwitch (r, "index", false)) .. "\n"
 	local foot = "    return " .. default .. ";\n  }\n\n"
-	write (head .. switch .. foot)
+	write (head, switch, foot)
 end
 
 function methodArgumentNames(method)
@@ -376,7 +377,7 @@ function writeMethodInvokeFunc(class, name, func)
 	             "    (void)__instance;\n"
 	local switch = indentCode (4, tableToSwitch (t, "index", false)) .. "\n"
 	local foot = "    return Nuria::Callback ();\n  }\n\n"
-	write (head .. switch .. foot)
+	write (head, switch, foot)
 end
 
 function prototypeArguments(types)
@@ -713,7 +714,7 @@ end
 function shouldFilterMethod(m)
 	local Avoid = function(type)
 		return definitions.declareTypes[type.type] == false or
-		       table.containsValue (definitions.avoidedTypes, type.type)
+		       definitions.avoidedTypeSet[type.type]
 	end
 	
 	if m.type == 'constructor' then return false end
@@ -806,7 +807,9 @@ function writeClassDef(name, class)
 	local EnumElemCount = function(v) return 'return ' .. table.length (v.elements) .. ';' end
 	
 	if class.hasValueSemantics then writeMemberConverters(class) end
-	class.methods = filterClassMethods (class)
+	
+	-- Classes are shared with the other generators, so don't modify them
+	class = setmetatable ({ methods = filterClassMethods (class) }, { __index = class })
 	
 	-- Write short methods
 	write ("class Q_DECL_HIDDEN " .. metaObjectClassName (name) .. " : public Nuria::MetaObject {\n" ..
@@ -899,8 +902,8 @@ function writeRegisterMetaObjectClass(class)
 end
 
 function writeRegisterConverter(conv)
-	if table.containsValue (definitions.avoidedTypes, conv.fromType) or
-	   table.containsValue (definitions.avoidedTypes, conv.toType) then
+	if definitions.avoidedTypeSet[conv.fromType] or
+	   definitions.avoidedTypeSet[conv.toType] then
 		return
 	end
 	
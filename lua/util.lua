@@ -56,8 +56,11 @@ function string:escaped()
 	return self:gsub ("\"", "\\\"")
 end
 
--- Calls func(value, key) on each element in 'table'
+-- Calls func(value, key) on each element in 'table'. Definitions are
+-- read-only, so these are copied first.
 function onEach(table, func)
+	if type(table) ~= 'table' then table = toTable (table) end
+	
 	for k,v in pairs(table) do
 		table[k] = func(v, k)
 	end
@@ -0,0 +1,345 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "batch.hpp"
+
+#include <QStringList>
+#include <QDebug>
+#include <QFile>
+#include <QTime>
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <map>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/Threading.h>
+
+#include "definitions.hpp"
+#include "resultcache.hpp"
+#include "triaaction.hpp"
+#include "compiledb.hpp"
+#include "compiler.hpp"
+#include "depfile.hpp"
+
+BatchRunner::BatchRunner (FileMapper *mapper, const std::vector< std::string > &arguments)
+	: m_mapper (mapper), m_arguments (arguments), m_nextJob (0), m_abort (false)
+{
+
+}
+
+void BatchRunner::setThreadCount (int threads) {
+	this->m_threads = threads;
+}
+
+void BatchRunner::setCompileDb (const CompileDb *database) {
+	this->m_database = database;
+}
+
+void BatchRunner::setPchCache (PchCache *cache) {
+	this->m_pchCache = cache;
+}
+
+void BatchRunner::setResultCache (ResultCache *cache) {
+	this->m_resultCache = cache;
+}
+
+void BatchRunner::setWriteDepFiles (bool write) {
+	this->m_writeDepFiles = write;
+}
+
+void BatchRunner::setWriteIfChanged (bool enable) {
+	this->m_writeIfChanged = enable;
+}
+
+bool BatchRunner::readManifest (const QString &path) {
+	QFile file (path);
+	if (!file.open (QIODevice::ReadOnly)) {
+		qCritical() << "Failed to open batch manifest" << path << ":" << file.errorString ();
+		return false;
+	}
+	
+	// 
+	while (!file.atEnd ()) {
+		QString line = QString::fromUtf8 (file.readLine ()).trimmed ();
+		if (line.isEmpty () || line.startsWith (QLatin1Char ('#'))) {
+			continue;
+		}
+		
+		BatchJob job;
+		if (!parseLine (line, job)) {
+			return false;
+		}
+		
+		this->m_jobs.append (job);
+	}
+	
+	return true;
+}
+
+const QVector< BatchJob > &BatchRunner::jobs () const {
+	return this->m_jobs;
+}
+
+bool BatchRunner::parseLine (const QString &line, BatchJob &job) {
+	QStringList fields = line.split (QLatin1Char (';'));
+	job.header = fields.first ().trimmed ();
+	
+	if (job.header.isEmpty ()) {
+		qCritical() << "Batch: No header given in line:" << line;
+		return false;
+	}
+	
+	if (this->m_database) {
+		job.arguments = this->m_database->flagsForHeader (job.header);
+	}
+	
+	// C++ and JSON output
+	QString cxxOutput = fields.value (1).trimmed ();
+	QString jsonOutput = fields.value (2).trimmed ();
+	
+	if (!cxxOutput.isEmpty ()) {
+		job.generators.append ({ QStringLiteral(":/lua/nuria.lua"), cxxOutput, QString () });
+	}
+	
+	if (!jsonOutput.isEmpty ()) {
+		job.generators.append ({ QStringLiteral(":/lua/json.lua"), jsonOutput, QString () });
+	}
+	
+	// Custom Lua generators
+	for (int i = 3; i < fields.length (); i++) {
+		QString config = fields.at (i).trimmed ();
+		GenConf genConf;
+		
+		if (config.isEmpty ()) {
+			continue;
+		}
+		
+		if (!LuaGenerator::parseConfig (config.toStdString (), genConf)) {
+			return false;
+		}
+		
+		job.generators.append (genConf);
+	}
+	
+	return true;
+}
+
+int BatchRunner::run () {
+	if (this->m_jobs.isEmpty ()) {
+		return 0;
+	}
+	
+	QTime timeTotal;
+	timeTotal.start ();
+	
+	// Start workers. The first one gets the shared file manager.
+	int threads = std::max (1, std::min (this->m_threads, this->m_jobs.length ()));
+	std::vector< std::thread > workers;
+	
+	this->m_results.clear ();
+	this->m_results.resize (this->m_jobs.length ());
+	this->m_nextJob = 0;
+	this->m_abort = false;
+	
+	// LLVM 3.4 only initializes its globals thread-safely if told so
+#if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR == 4
+	if (threads > 1) {
+		llvm::llvm_start_multithreaded ();
+	}
+	
+#endif
+	for (int i = 0; i < threads; i++) {
+		workers.emplace_back (&BatchRunner::workerMain, this);
+	}
+	
+	// Write results in manifest order as soon as they're available
+	int exitCode = 0;
+	for (int i = 0; i < this->m_jobs.length () && exitCode == 0; i++) {
+		const JobResult &result = this->m_results[i];
+		
+		std::unique_lock< std::mutex > lock (this->m_mutex);
+		this->m_jobDone.wait (lock, [&result]() { return result.done; });
+		lock.unlock ();
+		
+		exitCode = commitJob (this->m_jobs.at (i), result);
+		this->m_times.emplace_back (this->m_jobs.at (i).header.toStdString (), timeTotal.elapsed ());
+	}
+	
+	// Let workers finish their current job and quit
+	this->m_abort = true;
+	for (std::thread &cur : workers) {
+		cur.join ();
+	}
+	
+	this->m_results.clear ();
+	return exitCode;
+}
+
+const std::vector< std::pair< std::string, int > > &BatchRunner::times () const {
+	return this->m_times;
+}
+
+const std::vector< std::pair< std::string, bool > > &BatchRunner::outputs () const {
+	return this->m_outputs;
+}
+
+void BatchRunner::workerMain () {
+	
+	// A compiler is prepared for each distinct set of job arguments, and
+	// kept for following jobs with the same ones. As Clang 3.6 can't free a
+	// compiler, replacing it would leak it.
+	std::map< std::vector< std::string >, std::unique_ptr< Compiler > > compilers;
+	
+	while (!this->m_abort) {
+		int index = this->m_nextJob++;
+		if (index >= this->m_jobs.length ()) {
+			break;
+		}
+		
+		// The compiler is prepared with the first job of its arguments
+		const BatchJob &job = this->m_jobs.at (index);
+		JobResult &result = this->m_results[index];
+		
+		auto it = compilers.find (job.arguments);
+		if (it == compilers.end ()) {
+			std::vector< std::string > arguments = this->m_arguments;
+			arguments.insert (arguments.end (), job.arguments.begin (), job.arguments.end ());
+			arguments.push_back (job.header.toStdString ());
+			
+			std::unique_ptr< Compiler > compiler (new Compiler (nullptr));
+			compiler->setPchCache (this->m_pchCache);
+			if (!compiler->prepare (this->m_mapper, arguments)) {
+				finishJob (result, 1);
+				continue;
+			}
+			
+			it = compilers.emplace (job.arguments, std::move (compiler)).first;
+		}
+		
+		finishJob (result, runJob (*it->second, job, result));
+	}
+	
+}
+
+int BatchRunner::runJob (Compiler &compiler, const BatchJob &job, JobResult &result) {
+	Definitions definitions (QStringList (job.header));
+	
+	// Nothing to introspect?
+	if (LuaGenerator::allBuiltin (job.generators) && !TriaAction::mayIntrospect (QStringList (job.header))) {
+		if (this->m_writeDepFiles) {
+			result.dependencies.append (job.header);
+		}
+		
+		return runGenerators (compiler, definitions, job, result);
+	}
+	
+	compiler.setDefinitions (&definitions);
+	compiler.setMainFile (job.header.toStdString ());
+	
+	// Cached?
+	QByteArray cacheKey;
+	if (this->m_resultCache) {
+		cacheKey = this->m_resultCache->computeKey (compiler, job.generators);
+	}
+	
+	if (!cacheKey.isEmpty () && this->m_resultCache->lookup (cacheKey, result.outputs)) {
+		compiler.setDefinitions (nullptr);
+		if (this->m_writeDepFiles) {
+			result.dependencies = DepFile::dependencies (compiler, job.generators);
+		}
+		
+		return 0;
+	}
+	
+	// Parse
+	bool success = compiler.run ();
+	compiler.setDefinitions (nullptr);
+	
+	if (!success) {
+		return 2;
+	}
+	
+	if (this->m_writeDepFiles) {
+		result.dependencies = DepFile::dependencies (compiler, job.generators);
+	}
+	
+	definitions.parsingComplete ();
+	int exitCode = runGenerators (compiler, definitions, job, result);
+	
+	if (exitCode == 0 && !cacheKey.isEmpty ()) {
+		this->m_resultCache->store (cacheKey, result.outputs);
+	}
+	
+	return exitCode;
+}
+
+int BatchRunner::runGenerators (Compiler &compiler, Definitions &definitions, const BatchJob &job, JobResult &result) {
+	LuaGenerator luaGenerator (&definitions, &compiler);
+	for (int i = 0; i < job.generators.length (); i++) {
+		result.outputs.append (QByteArray ());
+		if (!luaGenerator.generate (job.generators.at (i), result.outputs.last ())) {
+			result.failedGenerator = i;
+			return 5;
+		}
+		
+	}
+	
+	return 0;
+}
+
+void BatchRunner::finishJob (JobResult &result, int exitCode) {
+	std::lock_guard< std::mutex > lock (this->m_mutex);
+	result.exitCode = exitCode;
+	result.done = true;
+	
+	this->m_jobDone.notify_all ();
+}
+
+int BatchRunner::commitJob (const BatchJob &job, const JobResult &result) {
+	for (int i = 0; i < result.outputs.length (); i++) {
+		const QString &outFile = job.generators.at (i).outFile;
+		
+		// Like in a serial run, the output of a failed generator is removed
+		if (i == result.failedGenerator) {
+			LuaGenerator::removeOutput (outFile);
+			
+		} else if (!this->m_writeIfChanged) {
+			if (!LuaGenerator::writeOutput (outFile, result.outputs.at (i))) {
+				return 5;
+			}
+			
+		} else {
+			bool changed = true;
+			if (!LuaGenerator::updateOutput (outFile, result.outputs.at (i), changed)) {
+				return 5;
+			}
+			
+			this->m_outputs.emplace_back (outFile.toStdString (), changed);
+		}
+		
+	}
+	
+	// Jobs writing to stdout only have no dependency file
+	QString target = DepFile::target (job.generators);
+	if (result.exitCode == 0 && this->m_writeDepFiles && !target.isEmpty () &&
+	    !DepFile::write (target + QStringLiteral(".d"), target, result.dependencies)) {
+		return 5;
+	}
+	
+	return result.exitCode;
+}
@@ -0,0 +1,155 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "luagenerator.hpp"
+
+#include <condition_variable>
+#include <QStringList>
+#include <QVector>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mutex>
+
+class Definitions;
+class FileMapper;
+class CompileDb;
+class Compiler;
+class ResultCache;
+class PchCache;
+
+struct BatchJob {
+	QString header;
+	QVector< GenConf > generators;
+	
+	// Additional compiler arguments, from the compilation database
+	std::vector< std::string > arguments;
+};
+
+/**
+ * Runs tria on many headers in one process. Each header gets its own set of
+ * outputs. All jobs share the same compiler set-up, only the main file
+ * changes in between.
+ *
+ * Jobs are read from a manifest file, one job per line:
+ * \code
+ * header;cxx-output;json-output[;lua-generator...]
+ * \endcode
+ *
+ * Empty fields are skipped, lines starting with '#' are ignored. Lua
+ * generators use the same syntax as the -lua-generator option.
+ * 
+ * Jobs can be run by multiple worker threads, each with its own compiler.
+ * Idle workers take the next job from the shared list. Generator output is
+ * buffered and written by the calling thread in manifest order, so the
+ * result is the same as of a serial run.
+ */
+class BatchRunner {
+public:
+	
+	BatchRunner (FileMapper *mapper, const std::vector< std::string > &arguments);
+	
+	/** Sets the count of worker threads. Defaults to \c 1. */
+	void setThreadCount (int threads);
+	
+	/**
+	 * Sets the compilation database the compiler flags of each job are
+	 * taken from. Must be set before reading the manifest.
+	 */
+	void setCompileDb (const CompileDb *database);
+	
+	/** Sets the cache of precompiled headers used by all workers. */
+	void setPchCache (PchCache *cache);
+	
+	/** Sets the cache of generator outputs used by all workers. */
+	void setResultCache (ResultCache *cache);
+	
+	/**
+	 * If \a write is \c true, a dependency file is written for each job.
+	 * It's named like the first output of the job plus ".d".
+	 */
+	void setWriteDepFiles (bool write);
+	
+	/**
+	 * If \a enable is \c true, outputs are only replaced if their content
+	 * has changed. See LuaGenerator::updateOutput().
+	 */
+	void setWriteIfChanged (bool enable);
+	
+	/** Reads the jobs from the manifest at \a path. */
+	bool readManifest (const QString &path);
+	
+	/** Returns the jobs to run. */
+	const QVector< BatchJob > &jobs () const;
+	
+	/**
+	 * Runs all jobs, stopping at the first failing one. Outputs of jobs
+	 * after it in the manifest are discarded. Returns \c 0 on success, or
+	 * the exit code tria would've returned for the failed job.
+	 */
+	int run ();
+	
+	/** Returns the time each job took, for -times. */
+	const std::vector< std::pair< std::string, int > > &times () const;
+	
+	/**
+	 * Returns for each output written in write-if-changed mode, whether it
+	 * was updated or kept.
+	 */
+	const std::vector< std::pair< std::string, bool > > &outputs () const;
+	
+private:
+	
+	struct JobResult {
+		bool done = false;
+		int exitCode = 0;
+		int failedGenerator = -1;
+		QVector< QByteArray > outputs;
+		QStringList dependencies;
+	};
+	
+	bool parseLine (const QString &line, BatchJob &job);
+	void workerMain ();
+	int runJob (Compiler &compiler, const BatchJob &job, JobResult &result);
+	int runGenerators (Compiler &compiler, Definitions &definitions, const BatchJob &job, JobResult &result);
+	void finishJob (JobResult &result, int exitCode);
+	int commitJob (const BatchJob &job, const JobResult &result);
+	
+	FileMapper *m_mapper;
+	const CompileDb *m_database = nullptr;
+	PchCache *m_pchCache = nullptr;
+	ResultCache *m_resultCache = nullptr;
+	int m_threads = 1;
+	bool m_writeDepFiles = false;
+	bool m_writeIfChanged = false;
+	std::vector< std::string > m_arguments;
+	QVector< BatchJob > m_jobs;
+	std::vector< std::pair< std::string, int > > m_times;
+	std::vector< std::pair< std::string, bool > > m_outputs;
+	
+	// Shared with the workers
+	std::vector< JobResult > m_results;
+	std::atomic< int > m_nextJob;
+	std::atomic< bool > m_abort;
+	std::mutex m_mutex;
+	std::condition_variable m_jobDone;
+	
+};
+
+#endif // BATCH_HPP
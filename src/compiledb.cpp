@@ -0,0 +1,230 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "compiledb.hpp"
+
+#include <clang/Tooling/JSONCompilationDatabase.h>
+#include <QFileInfo>
+#include <QDebug>
+#include <QDir>
+
+#include <algorithm>
+#include <cstring>
+
+CompileDb::CompileDb () {
+
+}
+
+CompileDb::~CompileDb () {
+
+}
+
+bool CompileDb::load (const std::string &buildDir) {
+	using namespace clang::tooling;
+	
+	std::string error;
+	std::string path = buildDir + "/compile_commands.json";
+	this->m_database.reset (JSONCompilationDatabase::loadFromFile (path, error));
+	
+	if (!this->m_database) {
+		qCritical() << "Failed to load compilation database:" << error.c_str ();
+		return false;
+	}
+	
+	// Index by absolute path
+	for (const std::string &file : this->m_database->getAllFiles ()) {
+		std::vector< CompileCommand > commands = this->m_database->getCompileCommands (file);
+		if (commands.empty ()) {
+			continue;
+		}
+		
+		Unit unit;
+		unit.command = commands.front ();
+		
+		QDir workingDir (QString::fromStdString (unit.command.Directory));
+		QFileInfo info (workingDir, QString::fromStdString (file));
+		unit.directory = QDir::cleanPath (info.absolutePath ());
+		unit.baseName = info.baseName ();
+		this->m_units.append (unit);
+	}
+	
+	return true;
+}
+
+static int commonPrefixLength (const QString &left, const QString &right) {
+	
+	// Compare with trailing slashes, so only whole directory names count
+	QString a = left + QLatin1Char ('/');
+	QString b = right + QLatin1Char ('/');
+	int length = 0;
+	
+	for (int i = 0; i < std::min (a.length (), b.length ()) && a.at (i) == b.at (i); i++) {
+		if (a.at (i) == QLatin1Char ('/')) {
+			length = i + 1;
+		}
+		
+	}
+	
+	return length;
+}
+
+const CompileDb::Unit *CompileDb::findOwner (const QString &header) const {
+	QFileInfo info (header);
+	QString directory = QDir::cleanPath (info.absolutePath ());
+	QString baseName = info.baseName ();
+	
+	const Unit *sameName = nullptr;
+	const Unit *closest = nullptr;
+	int closestLength = -1;
+	
+	for (const Unit &cur : this->m_units) {
+		if (cur.baseName == baseName) {
+			if (cur.directory == directory) {
+				return &cur;
+			} else if (!sameName) {
+				sameName = &cur;
+			}
+			
+		}
+		
+		int length = commonPrefixLength (cur.directory, directory);
+		if (length > closestLength) {
+			closestLength = length;
+			closest = &cur;
+		}
+		
+	}
+	
+	return (sameName) ? sameName : closest;
+}
+
+namespace {
+enum FlagKind {
+	PlainFlag, // Taken as-is
+	JoinedFlag, // Prefix of a flag which is taken as-is
+	ValueFlag, // Value is joined or the next argument
+	PathFlag // Like ValueFlag, but the value is a path
+};
+
+struct KnownFlag {
+	const char *name;
+	FlagKind kind;
+};
+
+}
+
+// Flags passed on to tria. Everything else, like code generation or warning
+// flags, doesn't matter for what tria does.
+static const KnownFlag knownFlags[] = {
+	{ "-I", PathFlag }, { "-isystem", PathFlag }, { "-iquote", PathFlag },
+	{ "-idirafter", PathFlag }, { "-isysroot", PathFlag }, { "--sysroot", PathFlag },
+	{ "-include", ValueFlag }, { "-imacros", ValueFlag }, // Searched like #include
+	{ "-D", ValueFlag }, { "-U", ValueFlag }, { "-target", ValueFlag },
+	{ "-std=", JoinedFlag }, { "-stdlib=", JoinedFlag }, { "--target=", JoinedFlag },
+	{ "-m32", PlainFlag }, { "-m64", PlainFlag }, { "-nostdinc", PlainFlag }, { "-nostdinc++", PlainFlag },
+	{ nullptr, PlainFlag }
+};
+
+// Flags which start like a known flag with a joined value, but are not.
+static const char *const otherFlags[] = {
+	"-include-pch", "-include-pth", "-isystem-after", "-target-",
+	nullptr
+};
+
+// Values are joined to single-dash flags, like "-Ifoo" or "-isystemfoo", or
+// to double-dash ones by '=', like "--sysroot=foo".
+static bool matchesFlag (const std::string &arg, const KnownFlag &flag) {
+	size_t length = strlen (flag.name);
+	if (arg.compare (0, length, flag.name) != 0) {
+		return false;
+	}
+	
+	if (arg.length () == length || flag.kind == JoinedFlag) {
+		return true;
+	} else if (flag.kind == PlainFlag) {
+		return false;
+	}
+	
+	return (flag.name[1] != '-' || arg[length] == '=');
+}
+
+static const KnownFlag *findFlag (const std::string &arg) {
+	for (const char *const *cur = otherFlags; *cur; cur++) {
+		if (arg.compare (0, strlen (*cur), *cur) == 0) {
+			return nullptr;
+		}
+		
+	}
+	
+	for (const KnownFlag *cur = knownFlags; cur->name; cur++) {
+		if (matchesFlag (arg, *cur)) {
+			return cur;
+		}
+		
+	}
+	
+	return nullptr;
+}
+
+static std::string absolutePath (const QDir &workingDir, const std::string &path) {
+	return QDir::cleanPath (workingDir.absoluteFilePath (QString::fromStdString (path))).toStdString ();
+}
+
+std::vector< std::string > CompileDb::flagsForHeader (const QString &header) const {
+	std::vector< std::string > flags;
+	const Unit *unit = findOwner (header);
+	if (!unit) {
+		return flags;
+	}
+	
+	// Skip the compiler itself
+	const std::vector< std::string > &args = unit->command.CommandLine;
+	QDir workingDir (QString::fromStdString (unit->command.Directory));
+	
+	for (size_t i = 1; i < args.size (); i++) {
+		const KnownFlag *flag = findFlag (args[i]);
+		if (!flag) {
+			continue;
+		}
+		
+		if (flag->kind == PlainFlag || flag->kind == JoinedFlag) {
+			flags.push_back (args[i]);
+			continue;
+		}
+		
+		// Value is either joined or the next argument
+		std::string value = args[i].substr (strlen (flag->name));
+		if (value.empty () && i + 1 < args.size ()) {
+			// "-Xclang -include -Xclang foo.h", as written by CMake
+			if (args[i + 1] == "-Xclang" && i + 2 < args.size ()) {
+				i++;
+			}
+			
+			value = args[++i];
+		} else if (flag->name[1] == '-' && value[0] == '=') { // --long=value
+			value.erase (0, 1);
+		}
+		
+		if (flag->kind == PathFlag) {
+			value = absolutePath (workingDir, value);
+		}
+		
+		flags.push_back (flag->name);
+		flags.push_back (value);
+	}
+	
+	return flags;
+}
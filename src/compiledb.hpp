@@ -0,0 +1,65 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPILEDB_HPP
+#define COMPILEDB_HPP
+
+#include <clang/Tooling/CompilationDatabase.h>
+#include <QString>
+#include <QVector>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Wrapper around the compile_commands.json of a build directory. Used to
+ * find the compiler flags of the translation unit owning a header.
+ */
+class CompileDb {
+public:
+	
+	CompileDb ();
+	~CompileDb ();
+	
+	/** Loads the compile_commands.json in \a buildDir. */
+	bool load (const std::string &buildDir);
+	
+	/**
+	 * Returns the flags relevant for parsing \a header, taken from the
+	 * translation unit owning it. The owner is the source file with the
+	 * same base name in the same directory, then in any directory, and
+	 * then the one sharing the longest directory prefix with \a header.
+	 *
+	 * Only pre-processor and language flags are returned, with relative
+	 * paths made absolute.
+	 */
+	std::vector< std::string > flagsForHeader (const QString &header) const;
+	
+private:
+	struct Unit {
+		QString directory;
+		QString baseName;
+		clang::tooling::CompileCommand command;
+	};
+	
+	const Unit *findOwner (const QString &header) const;
+	
+	std::unique_ptr< clang::tooling::CompilationDatabase > m_database;
+	QVector< Unit > m_units;
+	
+};
+
+#endif // COMPILEDB_HPP
@@ -22,8 +22,10 @@
 #include <clang/Frontend/CompilerInvocation.h>
 #include <clang/Frontend/FrontendDiagnostic.h>
 #include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendOptions.h>
 #include <clang/Frontend/CodeGenOptions.h>
 #include <clang/Frontend/TextDiagnostic.h>
+#include <clang/Frontend/ASTUnit.h>
 #include <clang/Driver/Compilation.h>
 #include <clang/Driver/Driver.h>
 #include <llvm/Option/ArgList.h>
@@ -31,8 +33,10 @@
 #include <llvm/Support/Host.h>
 #include <clang/Driver/Job.h>
 
+#include "definitions.hpp"
 #include "filemapper.hpp"
 #include "triaaction.hpp"
+#include "pchcache.hpp"
 
 Compiler::Compiler (Definitions *definitions) {
 	this->m_diagOpts = new clang::DiagnosticOptions;
@@ -48,7 +52,10 @@ Compiler::Compiler (Definitions *definitions) {
 
 Compiler::~Compiler () {
 #if LLVM_VERSION_MAJOR == 3 && LLVM_VERSION_MINOR < 6
-	delete this->m_compiler;
+	if (this->m_ownsInstance) {
+		delete this->m_compiler;
+	}
+	
 	delete this->m_action;
 //	delete this->m_invocation; // Owned by m_compiler
 	delete this->m_diag;
@@ -78,7 +85,8 @@ const llvm::opt::ArgStringList *Compiler::getCC1Arguments () const {
 	
 	const JobList &jobs = this->m_compilation->getJobs ();
 	
-	// TODO: Could we use jobs for proper multi-input file support?
+	// Multiple inputs are handled by re-running with another main file,
+	// see setMainFile().
 	if (jobs.size () != 1 || !llvm::isa< Command > (*jobs.begin())) {
 		llvm::SmallString< 256 > error_msg;
 		llvm::raw_svector_ostream error_stream (error_msg);
@@ -101,6 +109,55 @@ const llvm::opt::ArgStringList *Compiler::getCC1Arguments () const {
 	return &cmd.getArguments ();
 }
 
+void Compiler::setFileManager (clang::FileManager *fileManager) {
+	this->m_fileManager = fileManager;
+}
+
+void Compiler::setDefinitions (Definitions *definitions) {
+	this->m_action->setDefinitions (definitions);
+}
+
+void Compiler::setMainFile (const std::string &fileName) {
+	clang::FrontendOptions &opts = this->m_invocation->getFrontendOpts ();
+	clang::InputKind kind = clang::IK_CXX;
+	
+	if (!opts.Inputs.empty ()) {
+		kind = opts.Inputs.front ().getKind ();
+	}
+	
+	opts.Inputs.clear ();
+	opts.Inputs.push_back (clang::FrontendInputFile (fileName, kind));
+	this->m_arguments.back () = fileName;
+	
+	// Don't leak the AST of each run
+	opts.DisableFree = false;
+	this->m_invocation->getCodeGenOpts ().DisableFree = false;
+	
+	updatePch ();
+}
+
+void Compiler::setPchCache (PchCache *cache) {
+	this->m_pchCache = cache;
+}
+
+std::shared_ptr< const PchInfo > Compiler::pch () const {
+	return this->m_pch;
+}
+
+void Compiler::updatePch () {
+	this->m_pch = nullptr;
+	this->m_invocation->getPreprocessorOpts ().ImplicitPCHInclude.clear ();
+	
+	if (this->m_pchCache) {
+		this->m_pch = this->m_pchCache->lookup (this->m_fileMapper, this->m_arguments);
+	}
+	
+	if (this->m_pch) {
+		this->m_invocation->getPreprocessorOpts ().ImplicitPCHInclude = this->m_pch->path;
+	}
+	
+}
+
 bool Compiler::prepare (FileMapper *fileMapper, const std::vector< std::string > &arguments) {
 	std::vector< const char * > argv;
 	for (int i = 0, count = arguments.size (); i < count; i++) {
@@ -123,23 +180,114 @@ bool Compiler::prepare (FileMapper *fileMapper, const std::vector< std::string >
 	this->m_invocation->getCodeGenOpts ().DisableFree = true;
 	
 	// Map files
+	this->m_fileMapper = fileMapper;
 	fileMapper->applyMapping (this);
+	
+	updatePch ();
 	return true;
 }
 
 bool Compiler::run () {
-	clang::FileManager *fm = new clang::FileManager ({ "." });
+	Definitions *definitions = this->m_action->definitions ();
+	
+	// Declarations from the PCH aren't seen by the AST consumer
+	if (this->m_pch && definitions) {
+		for (const QString &cur : this->m_pch->declaredTypes) {
+			definitions->addDeclaredType (cur);
+		}
+		
+		for (const QString &cur : this->m_pch->avoidedTypes) {
+			definitions->avoidType (cur);
+		}
+		
+	}
+	
+	return run (*this->m_action);
+}
+
+bool Compiler::run (clang::FrontendAction &action) {
+	if (!this->m_fileManager) {
+		this->m_fileManager = this->m_fileMapper->createFileManager ();
+	}
+	
+	// The compiler instance keeps a reference to the file manager.
+	clang::FileManager *fm = this->m_fileManager;
 	this->m_compiler->setInvocation (this->m_invocation);
 	this->m_compiler->setFileManager (fm);
 	this->m_compiler->createDiagnostics (this->m_diagPrinter, false);
 	this->m_compiler->createSourceManager (*fm);
 	
-	bool success = this->m_compiler->ExecuteAction (*this->m_action);
+	bool success = this->m_compiler->ExecuteAction (action);
 	
 	fm->clearStatCaches ();
 	return success;
 }
 
+bool Compiler::loadAst (const std::string &fileName) {
+	
+	// The AST unit brings its own file and source manager
+	clang::CompilerInstance *ci = this->m_compiler;
+	ci->createDiagnostics (this->m_diagPrinter, false);
+	
+	llvm::IntrusiveRefCntPtr< clang::DiagnosticsEngine > diag (&ci->getDiagnostics ());
+	clang::FileSystemOptions fsOpts;
+#if CLANG_VERSION_MINOR < 6
+	this->m_astUnit.reset (clang::ASTUnit::LoadFromASTFile (fileName, diag, fsOpts));
+#else
+	this->m_astUnit = clang::ASTUnit::LoadFromASTFile (fileName, diag, fsOpts);
+#endif
+
+	if (!this->m_astUnit) {
+		return false;
+	}
+	
+	// Share everything with the compiler instance, so diagnostics and
+	// source locations work like after a normal run.
+	clang::ASTUnit *unit = this->m_astUnit.get ();
+	ci->getLangOpts () = unit->getLangOpts ();
+	ci->setFileManager (&unit->getFileManager ());
+	ci->setSourceManager (&unit->getSourceManager ());
+	ci->setPreprocessor (&unit->getPreprocessor ());
+	ci->setASTContext (&unit->getASTContext ());
+	
+	this->m_arguments = { fileName };
+	return true;
+}
+
+bool Compiler::runAst () {
+	this->m_action->consumeAst (*this->m_compiler);
+	return !this->m_compiler->getDiagnostics ().hasErrorOccurred ();
+}
+
+void Compiler::createSourceManager () {
+	clang::CompilerInstance *ci = this->m_compiler;
+	ci->createDiagnostics (this->m_diagPrinter, false);
+	
+	if (this->m_fileManager) {
+		ci->setFileManager (this->m_fileManager);
+	} else {
+		ci->createFileManager ();
+	}
+	
+	ci->createSourceManager (ci->getFileManager ());
+}
+
+void Compiler::useInstance (clang::CompilerInstance *instance) {
+	if (this->m_ownsInstance) {
+		delete this->m_compiler;
+	}
+	
+	// The text diagnostic refers to the language options of the instance
+	delete this->m_textDiag;
+	this->m_compiler = instance;
+	this->m_ownsInstance = false;
+	this->m_textDiag = new clang::TextDiagnostic (llvm::errs (), instance->getLangOpts (), this->m_diagOpts);
+}
+
+const std::vector< std::string > &Compiler::arguments () const {
+	return this->m_arguments;
+}
+
 clang::DiagnosticOptions *Compiler::diagOpts () const {
 	return this->m_diagOpts;
 }
@@ -171,3 +319,7 @@ clang::CompilerInvocation *Compiler::invocation () const {
 clang::CompilerInstance *Compiler::compiler () const {
 	return this->m_compiler;
 }
+
+clang::ASTUnit *Compiler::astUnit () const {
+	return this->m_astUnit.get ();
+}
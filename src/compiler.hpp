@@ -21,13 +21,17 @@
 #include <llvm/ADT/IntrusiveRefCntPtr.h>
 #include <clang/Basic/DiagnosticIDs.h>
 #include <llvm/Option/Option.h>
+#include <memory>
 #undef bool
 
 namespace clang {
 class TextDiagnosticPrinter;
+class FileManager;
 class CompilerInvocation;
 class CompilerInstance;
 class TextDiagnostic;
+class FrontendAction;
+class ASTUnit;
 
 namespace driver {
 class Compilation;
@@ -39,6 +43,8 @@ class Driver;
 class Definitions;
 class FileMapper;
 class TriaAction;
+class PchCache;
+struct PchInfo;
 class Compiler {
 public:
 	
@@ -46,9 +52,73 @@ public:
 	
 	~Compiler ();
 	
+	/**
+	 * Sets the file manager to use. If it's \c nullptr, which is the
+	 * default, the next run creates a new one. Watch mode uses this to
+	 * re-read changed files.
+	 */
+	void setFileManager (clang::FileManager *fileManager);
+	
+	/**
+	 * Sets the definitions the next run will write into. Together with
+	 * setMainFile(), this allows to run the same compiler on multiple
+	 * files.
+	 */
+	void setDefinitions (Definitions *definitions);
+	
+	/**
+	 * Replaces the main file of a prepare()'d compiler. Following runs
+	 * will parse \a fileName, with the same arguments as before.
+	 * The AST of each run is freed at the end of it, so only use the
+	 * results of a run until the next one has been started.
+	 */
+	void setMainFile (const std::string &fileName);
+	
+	/**
+	 * Sets the cache of precompiled headers. If set, the include prefix of
+	 * the main file is taken from a PCH.
+	 */
+	void setPchCache (PchCache *cache);
+	
+	/** Returns the PCH used for the main file, if any. */
+	std::shared_ptr< const PchInfo > pch () const;
+	
 	bool prepare (FileMapper *fileMapper, const std::vector< std::string > &arguments);
 	bool run ();
 	
+	/** Returns the arguments, with the current main file last. */
+	const std::vector< std::string > &arguments () const;
+	
+	/** Runs \a action instead of the TriaAction. */
+	bool run (clang::FrontendAction &action);
+	
+	/**
+	 * Loads the serialized AST in \a fileName, as written by
+	 * "clang -emit-ast" or as precompiled header. Use instead of
+	 * prepare(), the loaded AST is then used by runAst().
+	 */
+	bool loadAst (const std::string &fileName);
+	
+	/**
+	 * Runs the TriaAction on the declarations of the loaded AST. Nothing
+	 * is pre-processed or parsed.
+	 */
+	bool runAst ();
+	
+	/**
+	 * Only sets up diagnostics, a file and a source manager, without
+	 * parsing anything. Use instead of prepare() to run generators on
+	 * definitions read from a file.
+	 */
+	void createSourceManager ();
+	
+	/**
+	 * Uses \a instance instead of an own compiler instance, without taking
+	 * ownership. Used by the Clang plugin to run the generators on the
+	 * results of the compiler tria runs in.
+	 */
+	void useInstance (clang::CompilerInstance *instance);
+	
 	// 
 	clang::DiagnosticOptions *diagOpts () const;
 	clang::TextDiagnosticPrinter *diagPrinter () const;
@@ -58,10 +128,12 @@ public:
 	clang::driver::Compilation *compilation () const;
 	clang::CompilerInvocation *invocation () const;
 	clang::CompilerInstance *compiler () const;
+	clang::ASTUnit *astUnit () const;
 	
 private:
 	
 	const llvm::opt::ArgStringList *getCC1Arguments () const;
+	void updatePch ();
 	
 	std::vector< std::string > m_arguments;
 	clang::DiagnosticOptions *m_diagOpts;
@@ -73,6 +145,12 @@ private:
 	clang::driver::Compilation *m_compilation = nullptr;
 	clang::CompilerInvocation *m_invocation;
 	clang::CompilerInstance *m_compiler;
+	bool m_ownsInstance = true;
+	clang::FileManager *m_fileManager = nullptr;
+	FileMapper *m_fileMapper = nullptr;
+	PchCache *m_pchCache = nullptr;
+	std::shared_ptr< const PchInfo > m_pch;
+	std::unique_ptr< clang::ASTUnit > m_astUnit;
 	TriaAction *m_action;
 	
 };
@@ -0,0 +1,126 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "definitionindex.hpp"
+
+#include <QSet>
+
+static void appendOnce (DefinitionIndex::Positions &positions, int position) {
+	if (positions.isEmpty () || positions.last () != position) {
+		positions.append (position);
+	}
+	
+}
+
+void DefinitionIndex::build (const QVector< ClassDef > &classes) {
+	this->m_names.clear ();
+	this->m_files.clear ();
+	this->m_annotations.clear ();
+	this->m_bases.clear ();
+	this->m_derived.clear ();
+	
+	this->m_names.reserve (classes.length ());
+	for (int i = 0; i < classes.length (); i++) {
+		const ClassDef &def = classes.at (i);
+		if (!this->m_names.contains (def.name)) {
+			this->m_names.insert (def.name, i);
+		}
+		
+		this->m_files[def.file].append (i);
+		for (const AnnotationDef &cur : def.annotations) {
+			appendOnce (this->m_annotations[cur.name], i);
+		}
+		
+		for (const BaseDef &cur : def.bases) {
+			appendOnce (this->m_bases[cur.name], i);
+		}
+		
+	}
+	
+	// Walk up the inheritance tree of each class. Bases which are not in
+	// the list end the walk, but are still recorded.
+	QSet< Symbol > visited;
+	QVector< Symbol > pending;
+	for (int i = 0; i < classes.length (); i++) {
+		visited.clear ();
+		pending.clear ();
+		
+		for (const BaseDef &cur : classes.at (i).bases) {
+			pending.append (cur.name);
+		}
+		
+		while (!pending.isEmpty ()) {
+			Symbol base = pending.takeLast ();
+			if (visited.contains (base)) {
+				continue;
+			}
+			
+			visited.insert (base);
+			this->m_derived[base].append (i);
+			
+			int position = this->m_names.value (base, -1);
+			if (position != -1) {
+				for (const BaseDef &cur : classes.at (position).bases) {
+					pending.append (cur.name);
+				}
+				
+			}
+			
+		}
+		
+	}
+	
+}
+
+int DefinitionIndex::byName (const Symbol &name) const {
+	return this->m_names.value (name, -1);
+}
+
+DefinitionIndex::Positions DefinitionIndex::byFile (const Symbol &file) const {
+	return this->m_files.value (file);
+}
+
+DefinitionIndex::Positions DefinitionIndex::byAnnotation (const Symbol &name) const {
+	return this->m_annotations.value (name);
+}
+
+DefinitionIndex::Positions DefinitionIndex::byBase (const Symbol &base) const {
+	return this->m_bases.value (base);
+}
+
+DefinitionIndex::Positions DefinitionIndex::derivedFrom (const Symbol &base) const {
+	return this->m_derived.value (base);
+}
+
+const QHash< Symbol, int > &DefinitionIndex::names () const {
+	return this->m_names;
+}
+
+const QHash< Symbol, DefinitionIndex::Positions > &DefinitionIndex::files () const {
+	return this->m_files;
+}
+
+const QHash< Symbol, DefinitionIndex::Positions > &DefinitionIndex::annotations () const {
+	return this->m_annotations;
+}
+
+const QHash< Symbol, DefinitionIndex::Positions > &DefinitionIndex::bases () const {
+	return this->m_bases;
+}
+
+const QHash< Symbol, DefinitionIndex::Positions > &DefinitionIndex::derived () const {
+	return this->m_derived;
+}
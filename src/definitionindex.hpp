@@ -0,0 +1,73 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEFINITIONINDEX_HPP
+#define DEFINITIONINDEX_HPP
+
+#include <QVector>
+#include <QHash>
+
+#include "defs.hpp"
+
+/**
+ * Lookup tables over a list of classes, by name, by file, by annotation and
+ * by base class. Classes are referred to by their position in the list,
+ * positions are sorted ascending. Build it once the list is complete.
+ */
+class DefinitionIndex {
+public:
+	typedef QVector< int > Positions;
+	
+	/** Builds the index over \a classes, replacing the current one. */
+	void build (const QVector< ClassDef > &classes);
+	
+	/** Returns the position of the class called \a name, or -1. */
+	int byName (const Symbol &name) const;
+	
+	/** Returns the classes declared in \a file. */
+	Positions byFile (const Symbol &file) const;
+	
+	/** Returns the classes annotated with \a name. */
+	Positions byAnnotation (const Symbol &name) const;
+	
+	/** Returns the classes which directly inherit \a base. */
+	Positions byBase (const Symbol &base) const;
+	
+	/**
+	 * Returns the classes which inherit \a base, directly or through any
+	 * of the other classes. \a base doesn't have to be a known class.
+	 */
+	Positions derivedFrom (const Symbol &base) const;
+	
+	// 
+	const QHash< Symbol, int > &names () const;
+	const QHash< Symbol, Positions > &files () const;
+	const QHash< Symbol, Positions > &annotations () const;
+	const QHash< Symbol, Positions > &bases () const;
+	const QHash< Symbol, Positions > &derived () const;
+	
+private:
+	friend class DefsFile;
+	
+	QHash< Symbol, int > m_names;
+	QHash< Symbol, Positions > m_files;
+	QHash< Symbol, Positions > m_annotations;
+	QHash< Symbol, Positions > m_bases;
+	QHash< Symbol, Positions > m_derived;
+	
+};
+
+#endif // DEFINITIONINDEX_HPP
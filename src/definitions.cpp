@@ -45,13 +45,88 @@ QStringList Definitions::sourceFiles () const {
 void Definitions::addClassDefinition (const ClassDef &theClass) {
 	this->m_classes.append (theClass);
 	cleanUpClassDef (this->m_classes.last ());
+	this->m_indexValid = false;
 }
 
-QVector< ClassDef > Definitions::classDefintions () const {
+const QVector< ClassDef > &Definitions::classDefintions () const {
 	return this->m_classes;
 }
 
-StringSet Definitions::declaredTypes () const {
+const DefinitionIndex &Definitions::index () const {
+	if (!this->m_indexValid) {
+		this->m_index.build (this->m_classes);
+		this->m_indexValid = true;
+	}
+	
+	return this->m_index;
+}
+
+template< typename T >
+static bool sortByName (const T &lhs, const T &rhs) {
+	return lhs.name < rhs.name;
+}
+
+static bool methodLess (const MethodDef &lhs, const MethodDef &rhs) {
+	if (lhs.name == rhs.name) {
+		return lhs.arguments.length () < rhs.arguments.length ();
+	}
+	
+	return lhs.name < rhs.name;
+}
+
+// Each run with -global-class produces a fake class of the same name, so
+// merge their global functions and enums instead of dropping them.
+static void mergeFakeClass (ClassDef &def, const ClassDef &other) {
+	def.methods += other.methods;
+	def.enums += other.enums;
+	
+	std::sort (def.methods.begin (), def.methods.end (), methodLess);
+	std::sort (def.enums.begin (), def.enums.end (), &sortByName< EnumDef >);
+}
+
+void Definitions::merge (const Definitions &other) {
+	for (const QString &cur : other.m_fileNames) {
+		if (!this->m_fileNames.contains (cur)) {
+			this->m_fileNames.append (cur);
+		}
+		
+	}
+	
+	this->m_declaredTypes.unite (other.m_declaredTypes);
+	for (auto it = other.m_declareTypes.constBegin (), end = other.m_declareTypes.constEnd (); it != end; ++it) {
+		declareType (it.key (), it.value ());
+	}
+	
+	for (const QString &cur : other.m_avoidedTypes) {
+		avoidType (cur);
+	}
+	
+	for (auto it = other.m_typeDefs.constBegin (), end = other.m_typeDefs.constEnd (); it != end; ++it) {
+		this->m_typeDefs.insert (it.key (), it.value ());
+	}
+	
+	// Classes have been cleaned up when they were added to other
+	QHash< Symbol, int > known;
+	known.reserve (this->m_classes.length () + other.m_classes.length ());
+	for (int i = 0; i < this->m_classes.length (); i++) {
+		known.insert (this->m_classes.at (i).name, i);
+	}
+	
+	for (const ClassDef &cur : other.m_classes) {
+		auto it = known.constFind (cur.name);
+		if (it == known.constEnd ()) {
+			known.insert (cur.name, this->m_classes.length ());
+			this->m_classes.append (cur);
+		} else if (cur.isFakeClass && this->m_classes.at (*it).isFakeClass) {
+			mergeFakeClass (this->m_classes[*it], cur);
+		}
+		
+	}
+	
+	this->m_indexValid = false;
+}
+
+const StringSet &Definitions::declaredTypes () const {
 	return this->m_declaredTypes;
 }
 
@@ -63,7 +138,7 @@ bool Definitions::isTypeDeclared (const QString &type) {
 	return this->m_declaredTypes.contains (type);
 }
 
-QMap< QString, bool > Definitions::declareTypes() const {
+const QMap< QString, bool > &Definitions::declareTypes () const {
 	return this->m_declareTypes;
 }
 
@@ -82,11 +157,11 @@ void Definitions::addTypeDef (const QString &desugared, const QString &typeDef)
 	this->m_typeDefs.insert (typeDef, desugared);
 }
 
-StringSet Definitions::avoidedTypes () const {
+const StringSet &Definitions::avoidedTypes () const {
 	return this->m_avoidedTypes;
 }
 
-StringMap Definitions::typedefs () const {
+const StringMap &Definitions::typedefs () const {
 	return this->m_typeDefs;
 }
 
@@ -96,6 +171,7 @@ bool Definitions::isTypeAvoided (const QString &type) {
 
 void Definitions::avoidType (const QString &type) {
 	this->m_avoidedTypes.insert (type);
+	this->m_avoidedSymbols.insert (Symbol (type));
 }
 
 TimingNode *Definitions::timing () const {
@@ -113,20 +189,20 @@ void Definitions::setTimingNode (TimingNode *node) {
 	this->m_timing = node;
 }
 
-template< typename T >
-static bool sortByName (const T &lhs, const T &rhs) {
-	return lhs.name < rhs.name;
+int Definitions::typeNameLookups () const {
+	return this->m_typeNameLookups;
 }
 
-static bool methodLess (const MethodDef &lhs, const MethodDef &rhs) {
-	if (lhs.name == rhs.name) {
-		return lhs.arguments.length () < rhs.arguments.length ();
-	}
-	
-	return lhs.name < rhs.name;
+int Definitions::typeNameHits () const {
+	return this->m_typeNameHits;
 }
 
-static bool checkArgumentsForAvoidedTypes (const StringSet &avoid, const Variables &args) {
+void Definitions::addTypeNameStats (int lookups, int hits) {
+	this->m_typeNameLookups += lookups;
+	this->m_typeNameHits += hits;
+}
+
+static bool checkArgumentsForAvoidedTypes (const QSet< Symbol > &avoid, const Variables &args) {
 	for (const VariableDef &cur : args) {
 		if (avoid.contains (cur.type)) {
 			return true;
@@ -137,31 +213,14 @@ static bool checkArgumentsForAvoidedTypes (const StringSet &avoid, const Variabl
 	return false;
 }
 
-static void filterMethods (const StringSet &avoid, Methods &methods) {
-	for (int i = 0; i < methods.length (); i++) {
-		const MethodDef &cur = methods.at (i);
-		
-		if ((!cur.name.isEmpty () && avoid.contains (cur.returnType.type)) ||
-		    checkArgumentsForAvoidedTypes (avoid, cur.arguments)) {
-			methods.remove (i);
-			i--;
-		}
-		
-	}
-	
+static bool isMethodAvoided (const QSet< Symbol > &avoid, const MethodDef &method) {
+	return ((!method.name.isEmpty () && avoid.contains (method.returnType.type)) ||
+	        checkArgumentsForAvoidedTypes (avoid, method.arguments));
 }
 
-static void filterFields (const StringSet &avoid, Variables &fields) {
-	for (int i = 0; i < fields.length (); i++) {
-		const VariableDef &cur = fields.at (i);
-		
-		if (avoid.contains (cur.type)) {
-			fields.remove (i);
-			i--;
-		}
-		
-	}
-	
+static void filterFields (const QSet< Symbol > &avoid, Variables &fields) {
+	auto isAvoided = [&avoid](const VariableDef &cur) { return avoid.contains (cur.type); };
+	fields.erase (std::remove_if (fields.begin (), fields.end (), isAvoided), fields.end ());
 }
 
 static int firstOptionalArgument (const MethodDef &method) {
@@ -176,32 +235,56 @@ static int firstOptionalArgument (const MethodDef &method) {
 	return i;
 }
 
-static void expandMethodsWithOptionalArgs (Methods &methods) {
+// Filters methods using avoided types, and exposes methods with optional
+// arguments as overloads, in one pass. The overloads are put in front of
+// the full method.
+static void filterAndExpandMethods (const QSet< Symbol > &avoid, Methods &methods) {
+	int count = 0;
+	bool changed = false;
+	for (const MethodDef &cur : methods) {
+		int optional = cur.arguments.length () - firstOptionalArgument (cur);
+		if (isMethodAvoided (avoid, cur)) {
+			changed = true;
+		} else {
+			count += 1 + optional;
+			changed = changed || (optional > 0);
+		}
+		
+	}
+	
+	// Removed methods and added overloads may cancel out in the count
+	if (!changed) {
+		return;
+	}
 	
-	for (auto it = methods.begin (); it != methods.end (); ++it) {
-		MethodDef cur = *it; // Intentionally not a reference.
-		int totalArgs = cur.arguments.length ();
-		for (int i = firstOptionalArgument (cur); i < totalArgs; i++, ++it) {
-			MethodDef overload = cur;
-			overload.arguments.resize (i);
-			it = methods.insert (it, overload);
+	// 
+	Methods result;
+	result.reserve (count);
+	for (const MethodDef &cur : methods) {
+		if (isMethodAvoided (avoid, cur)) {
+			continue;
+		}
+		
+		for (int i = firstOptionalArgument (cur); i < cur.arguments.length (); i++) {
+			result.append (cur);
+			result.last ().arguments.resize (i);
 		}
 		
+		result.append (cur);
 	}
 	
+	methods.swap (result);
 }
 
 void Definitions::cleanUpClassDef (ClassDef &def) {
 	
 	// Filter methods and fields which can't be exposed as their type(s)
 	// doesn't have value-semantics.
-	filterMethods (this->m_avoidedTypes, def.methods);
-	filterFields (this->m_avoidedTypes, def.variables);
-	
-	// Expose methods with optional arguments as overloads. Expand first to
-	// catch cases where a class has static and member methods of the same
-	// name.
-	expandMethodsWithOptionalArgs (def.methods);
+	// Also expose methods with optional arguments as overloads. Expand
+	// before sorting to catch cases where a class has static and member
+	// methods of the same name.
+	filterAndExpandMethods (this->m_avoidedSymbols, def.methods);
+	filterFields (this->m_avoidedSymbols, def.variables);
 	
 	// Sort methods, fields and enums for faster access
 	std::sort (def.bases.begin (), def.bases.end (), &sortByName< BaseDef >);
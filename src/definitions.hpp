@@ -17,6 +17,7 @@
 #ifndef DEFINITIONS_HPP
 #define DEFINITIONS_HPP
 
+#include "definitionindex.hpp"
 #include "defs.hpp"
 #undef bool
 
@@ -43,15 +44,27 @@ public:
 	/** Adds \a theClass. */
 	void addClassDefinition (const ClassDef &theClass);
 	
-	/** Returns all class definitions */
-	QVector< ClassDef > classDefintions () const;
+	/** Returns all class definitions. The reference is valid until the next change. */
+	const QVector< ClassDef > &classDefintions () const;
+	
+	/**
+	 * Returns the lookup tables of the class definitions. The index is
+	 * built on first use after a change.
+	 */
+	const DefinitionIndex &index () const;
+	
+	/**
+	 * Adds everything of \a other. Classes which are already known by name
+	 * are skipped, so a class seen from multiple headers is kept once.
+	 */
+	void merge (const Definitions &other);
 	
 	/**
 	 * Returns the types which should be declared.
 	 * Avoided types over-rule this list. This list in turn over-rules
 	 * "declareTypes".
 	 */
-	StringSet declaredTypes () const;
+	const StringSet &declaredTypes () const;
 	
 	/** Registers \a type as already Q_DECLARE_METATYPE'd. */
 	void addDeclaredType (const QString &type);
@@ -60,7 +73,7 @@ public:
 	bool isTypeDeclared (const QString &type);
 	
 	/** Returns the list of to-be-declared types. */
-	QMap< QString, bool > declareTypes () const;
+	const QMap< QString, bool > &declareTypes () const;
 	
 	/** Tells the generator to generate a metatype declaration. */
 	void declareType (const QString &type, bool isFullyDeclared);
@@ -79,10 +92,10 @@ public:
 	 * 
 	 * \note Please note, that T is not T* - The latter is always fine.
 	 */
-	StringSet avoidedTypes () const;
+	const StringSet &avoidedTypes () const;
 	
 	/** Returns all typedefs. */
-	StringMap typedefs () const;
+	const StringMap &typedefs () const;
 	
 	/** Returns \c true if \a type should be avoided. */
 	bool isTypeAvoided (const QString &type);
@@ -94,10 +107,17 @@ public:
 	TimingNode *timing () const;
 	void parsingComplete ();
 	
+	/** Returns how many type names were looked up, and how many of those were cached. */
+	int typeNameLookups () const;
+	int typeNameHits () const;
+	
 private:
 	friend class TriaAction;
+	friend class TriaASTConsumer;
+	friend class DefsFile;
 	
 	void setTimingNode (TimingNode *node);
+	void addTypeNameStats (int lookups, int hits);
 	
 	void cleanUpClassDef (ClassDef &def);
 	
@@ -106,9 +126,14 @@ private:
 	StringSet m_declaredTypes;
 	QMap< QString, bool > m_declareTypes;
 	StringSet m_avoidedTypes;
+	QSet< Symbol > m_avoidedSymbols;
 	StringMap m_typeDefs;
 	QVector< ClassDef > m_classes;
+	mutable DefinitionIndex m_index;
+	mutable bool m_indexValid = false;
 	TimingNode *m_timing = nullptr;
+	int m_typeNameLookups = 0;
+	int m_typeNameHits = 0;
 	
 };
 
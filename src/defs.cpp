@@ -23,7 +23,7 @@ static const char *methodTypeStr[] = { "Constructor", "Destructor", "Method", "S
 static const char *accessStr[] = { "public", "protected", "private", "none" };
 
 QDebug operator<< (QDebug dbg, const AnnotationDef &annotation) {
-	dbg.nospace () << annotation.name << "(" << annotation.value << ")";
+	dbg.nospace () << annotation.name.toString () << "(" << annotation.value << ")";
 	return dbg;
 }
 
@@ -45,8 +45,8 @@ static void dumpAnnotations (QDebug &dbg, const Annotations &annotations) {
 QDebug operator<< (QDebug dbg, const VariableDef &variable) {
 	dumpAnnotations (dbg, variable.annotations);
 	dbg.nospace () << accessStr[variable.access] << " "
-		       << qPrintable(variable.type) << " "
-		       << qPrintable(variable.name);
+		       << variable.type.data () << " "
+		       << variable.name.data ();
 	
 	return dbg.maybeSpace ();
 }
@@ -57,7 +57,7 @@ QDebug operator<< (QDebug dbg, const BaseDef &base) {
 		dbg << "virtual ";
 	}
 	
-	dbg << qPrintable(base.name);
+	dbg << base.name.data ();
 	return dbg.maybeSpace ();
 }
 
@@ -70,8 +70,8 @@ QDebug operator<< (QDebug dbg, const MethodDef &method) {
 	dumpAnnotations (dbg, method.annotations);
 	
 	dbg.nospace () << accessStr[method.access] << " "
-		       << qPrintable(method.returnType.type) << " "
-		       << qPrintable(method.name);
+		       << method.returnType.type.data () << " "
+		       << method.name.data ();
 	
 	dbg.nospace () << "(";
 	for (const VariableDef &cur : method.arguments) {
@@ -88,7 +88,7 @@ QDebug operator<< (QDebug dbg, const MethodDef &method) {
 }
 
 QDebug operator<< (QDebug dbg, const ClassDef &def) {
-	dbg.nospace () << "Class " << accessStr[def.access] << " " << qPrintable(def.name);
+	dbg.nospace () << "Class " << accessStr[def.access] << " " << def.name.data ();
 	
 	dumpAnnotations (dbg, def.annotations);
 	dbg.nospace () << "\n";
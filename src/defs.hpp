@@ -24,6 +24,8 @@
 #include <QVector>
 #include <QMap>
 
+#include "symboltable.hpp"
+
 enum MethodType {
 	ConstructorMethod = 0,
 	DestructorMethod,
@@ -43,7 +45,7 @@ enum AnnotationType {
 struct AnnotationDef {
 	clang::SourceRange loc;
 	AnnotationType type;
-	QString name;
+	Symbol name;
 	QString value;
 	QMetaType::Type valueType = QMetaType::QVariant;
 	int index = -1;
@@ -55,12 +57,12 @@ struct VariableDef {
 	clang::SourceRange loc;
 	clang::AccessSpecifier access = clang::AS_public;
 	
-	QString name;
-	QString type;
+	Symbol name;
+	Symbol type;
 	
-	QString getter;
-	QString setterArgName;
-	QString setter;
+	Symbol getter;
+	Symbol setterArgName;
+	Symbol setter;
 	
 	Annotations annotations;
 	
@@ -80,7 +82,7 @@ struct MethodDef {
 	bool isVirtual;
 	bool isPure;
 	bool isConst;
-	QString name;
+	Symbol name;
 	VariableDef returnType;
 	Variables arguments;
 	Annotations annotations;
@@ -92,10 +94,10 @@ typedef QVector< MethodDef > Methods;
 
 struct ConversionDef {
 	clang::SourceRange loc;
-	QString methodName;
+	Symbol methodName;
 	MethodType type;
-	QString fromType;
-	QString toType;
+	Symbol fromType;
+	Symbol toType;
 	bool isConst;
 };
 
@@ -105,7 +107,7 @@ struct BaseDef {
 	clang::AccessSpecifier access;
 	clang::SourceRange loc;
 	bool isVirtual;
-	QString name;
+	Symbol name;
 	
 };
 
@@ -114,7 +116,7 @@ typedef QVector< BaseDef > Bases;
 struct EnumDef {
 	clang::SourceRange loc;
 	
-	QString name;
+	Symbol name;
 	QMap< QString, int > elements;
 	Annotations annotations;
 	
@@ -126,8 +128,8 @@ struct ClassDef {
 	clang::AccessSpecifier access;
 	clang::SourceRange loc;
 	Bases bases;
-	QString name;
-	QString file;
+	Symbol name;
+	Symbol file;
 	Variables variables;
 	Methods methods;
 	Enums enums;
@@ -0,0 +1,796 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "defsfile.hpp"
+
+#include <clang/Basic/SourceManager.h>
+#include <clang/Basic/FileManager.h>
+
+#include <QSaveFile>
+#include <QVector>
+#include <QDebug>
+#include <QFile>
+#include <QHash>
+
+#include <initializer_list>
+#include <algorithm>
+#include <cstring>
+
+#include "definitions.hpp"
+#include "symboltable.hpp"
+
+namespace {
+
+struct FileHeader {
+	char magic[4];
+	quint32 version;
+	quint32 byteOrder;
+	quint32 stringCount;
+	quint32 stringTable; // Offset of a StringEntry per string
+	quint32 data; // Offset of the definitions
+	quint32 dataWords;
+};
+
+struct StringEntry {
+	quint32 offset;
+	quint32 length; // Without the trailing NUL
+};
+
+const char fileMagic[4] = { 'T', 'D', 'B', '\0' };
+const quint32 byteOrderMark = 0x01020304;
+
+// Serializes definitions into words. String 0 is always the empty string,
+// which also marks an invalid location.
+class Writer {
+public:
+	
+	Writer (clang::SourceManager *sm)
+		: m_sm (sm)
+	{
+		
+		stringId (QByteArray ());
+		
+	}
+	
+	void word (quint32 value)
+	{ this->m_data.append (value); }
+	
+	void string (const QByteArray &data)
+	{ word (stringId (data)); }
+	
+	void string (const QString &string)
+	{ word (stringId (string.toUtf8 ())); }
+	
+	void symbol (const Symbol &symbol) {
+		auto it = this->m_symbolIds.constFind (symbol.id ());
+		if (it == this->m_symbolIds.constEnd ()) {
+			it = this->m_symbolIds.insert (symbol.id (), stringId (symbol.utf8 ()));
+		}
+		
+		word (*it);
+	}
+	
+	void location (clang::SourceLocation loc);
+	void range (const clang::SourceRange &range);
+	void annotations (const Annotations &annotations);
+	void variable (const VariableDef &variable);
+	void method (const MethodDef &method);
+	void classDef (const ClassDef &def);
+	void positionsMap (const QHash< Symbol, DefinitionIndex::Positions > &map);
+	
+	QByteArray finish ();
+	
+private:
+	quint32 stringId (const QByteArray &data);
+	
+	clang::SourceManager *m_sm;
+	QVector< quint32 > m_data;
+	QVector< QByteArray > m_strings;
+	QHash< QByteArray, quint32 > m_stringIds;
+	QHash< quint32, quint32 > m_symbolIds;
+	
+};
+
+// Reads definitions from a mapped file. All reads are checked against the
+// end of the data, a failed read sets the reader to an error state.
+class Reader {
+public:
+	
+	Reader (clang::SourceManager &sm)
+		: m_sm (sm)
+	{ }
+	
+	bool open (const uchar *data, qint64 size);
+	
+	bool isValid () const
+	{ return this->m_valid; }
+	
+	bool atEnd () const
+	{ return this->m_pos == this->m_end; }
+	
+	quint32 word () {
+		if (this->m_pos == this->m_end) {
+			this->m_valid = false;
+			return 0;
+		}
+		
+		return *this->m_pos++;
+	}
+	
+	int count ();
+	Symbol symbol ();
+	QString string ();
+	
+	clang::SourceLocation location ();
+	clang::SourceRange range ();
+	Annotations annotations ();
+	VariableDef variable ();
+	MethodDef method ();
+	ClassDef classDef ();
+	int position (int classCount);
+	void positionsMap (QHash< Symbol, DefinitionIndex::Positions > &map, int classCount);
+	
+private:
+	quint32 stringIndex ();
+	
+	clang::SourceManager &m_sm;
+	const uchar *m_base = nullptr;
+	const StringEntry *m_strings = nullptr;
+	quint32 m_stringCount = 0;
+	const quint32 *m_pos = nullptr;
+	const quint32 *m_end = nullptr;
+	bool m_valid = false;
+	
+	QVector< Symbol > m_symbols;
+	QHash< quint32, clang::FileID > m_files;
+	
+};
+
+}
+
+static quint32 flags (std::initializer_list< bool > bits) {
+	quint32 result = 0;
+	quint32 bit = 1;
+	for (bool cur : bits) {
+		result |= (cur ? bit : 0);
+		bit <<= 1;
+	}
+	
+	return result;
+}
+
+quint32 Writer::stringId (const QByteArray &data) {
+	auto it = this->m_stringIds.constFind (data);
+	if (it != this->m_stringIds.constEnd ()) {
+		return *it;
+	}
+	
+	quint32 id = this->m_strings.length ();
+	this->m_strings.append (data);
+	this->m_stringIds.insert (data, id);
+	return id;
+}
+
+void Writer::location (clang::SourceLocation loc) {
+	const clang::FileEntry *entry = nullptr;
+	std::pair< clang::FileID, unsigned > decomposed;
+	
+	if (this->m_sm && loc.isValid ()) {
+		decomposed = this->m_sm->getDecomposedLoc (this->m_sm->getFileLoc (loc));
+		entry = this->m_sm->getFileEntryForID (decomposed.first);
+	}
+	
+	if (!entry) {
+		word (0);
+		word (0);
+		word (0);
+		return;
+	}
+	
+	string (QByteArray (entry->getName ()));
+	word (this->m_sm->getLineNumber (decomposed.first, decomposed.second));
+	word (this->m_sm->getColumnNumber (decomposed.first, decomposed.second));
+}
+
+void Writer::range (const clang::SourceRange &range) {
+	location (range.getBegin ());
+	location (range.getEnd ());
+}
+
+void Writer::annotations (const Annotations &annotations) {
+	word (annotations.length ());
+	for (const AnnotationDef &cur : annotations) {
+		range (cur.loc);
+		word (cur.type);
+		symbol (cur.name);
+		string (cur.value);
+		word (cur.valueType);
+		word (cur.index);
+	}
+	
+}
+
+void Writer::variable (const VariableDef &variable) {
+	range (variable.loc);
+	word (variable.access);
+	symbol (variable.name);
+	symbol (variable.type);
+	symbol (variable.getter);
+	symbol (variable.setterArgName);
+	symbol (variable.setter);
+	annotations (variable.annotations);
+	word (flags ({ variable.isReference, variable.isConst, variable.isPodType,
+	               variable.isOptional, variable.setterReturnsBool }));
+}
+
+void Writer::method (const MethodDef &method) {
+	range (method.loc);
+	word (method.access);
+	word (method.type);
+	word (flags ({ method.isVirtual, method.isPure, method.isConst, method.hasOptionalArguments }));
+	symbol (method.name);
+	variable (method.returnType);
+	
+	word (method.arguments.length ());
+	for (const VariableDef &cur : method.arguments) {
+		variable (cur);
+	}
+	
+	annotations (method.annotations);
+}
+
+void Writer::classDef (const ClassDef &def) {
+	word (def.access);
+	range (def.loc);
+	symbol (def.name);
+	symbol (def.file);
+	
+	word (def.bases.length ());
+	for (const BaseDef &cur : def.bases) {
+		word (cur.access);
+		range (cur.loc);
+		word (cur.isVirtual);
+		symbol (cur.name);
+	}
+	
+	word (def.variables.length ());
+	for (const VariableDef &cur : def.variables) {
+		variable (cur);
+	}
+	
+	word (def.methods.length ());
+	for (const MethodDef &cur : def.methods) {
+		method (cur);
+	}
+	
+	word (def.enums.length ());
+	for (const EnumDef &cur : def.enums) {
+		range (cur.loc);
+		symbol (cur.name);
+		
+		word (cur.elements.size ());
+		for (auto it = cur.elements.constBegin (), end = cur.elements.constEnd (); it != end; ++it) {
+			string (it.key ());
+			word (it.value ());
+		}
+		
+		annotations (cur.annotations);
+	}
+	
+	word (def.conversions.length ());
+	for (const ConversionDef &cur : def.conversions) {
+		range (cur.loc);
+		symbol (cur.methodName);
+		word (cur.type);
+		symbol (cur.fromType);
+		symbol (cur.toType);
+		word (cur.isConst);
+	}
+	
+	annotations (def.annotations);
+	word (flags ({ def.isFakeClass, def.hasValueSemantics, def.hasDefaultCtor, def.hasCopyCtor,
+	               def.hasAssignmentOperator, def.implementsCtor, def.implementsCopyCtor,
+	               def.hasPureVirtuals }));
+}
+
+// QHash and QSet iterate in a different order in each process. Their keys
+// are written sorted, so the same definitions always give the same file.
+template< typename T >
+static QList< Symbol > sortedKeys (const QHash< Symbol, T > &hash) {
+	QList< Symbol > keys = hash.keys ();
+	std::sort (keys.begin (), keys.end ());
+	return keys;
+}
+
+static QStringList sortedValues (const StringSet &set) {
+	QStringList list = set.toList ();
+	list.sort ();
+	return list;
+}
+
+void Writer::positionsMap (const QHash< Symbol, DefinitionIndex::Positions > &map) {
+	word (map.size ());
+	for (const Symbol &key : sortedKeys (map)) {
+		const DefinitionIndex::Positions &positions = map[key];
+		symbol (key);
+		word (positions.length ());
+		for (int cur : positions) {
+			word (cur);
+		}
+		
+	}
+	
+}
+
+QByteArray Writer::finish () {
+	FileHeader header;
+	memcpy (header.magic, fileMagic, sizeof(fileMagic));
+	header.version = DefsFile::Version;
+	header.byteOrder = byteOrderMark;
+	header.stringCount = this->m_strings.length ();
+	header.stringTable = sizeof(FileHeader);
+	
+	// Each string is NUL-terminated, the definitions are aligned to words.
+	QVector< StringEntry > table;
+	quint32 offset = header.stringTable + header.stringCount * sizeof(StringEntry);
+	table.reserve (this->m_strings.length ());
+	for (const QByteArray &cur : this->m_strings) {
+		table.append ({ offset, quint32 (cur.length ()) });
+		offset += cur.length () + 1;
+	}
+	
+	header.data = (offset + 3) & ~3U;
+	header.dataWords = this->m_data.length ();
+	
+	// 
+	QByteArray result;
+	result.reserve (header.data + header.dataWords * sizeof(quint32));
+	result.append ((const char *)&header, sizeof(header));
+	result.append ((const char *)table.constData (), table.length () * sizeof(StringEntry));
+	
+	for (const QByteArray &cur : this->m_strings) {
+		result.append (cur.constData (), cur.length () + 1);
+	}
+	
+	result.append (QByteArray (header.data - offset, '\0'));
+	result.append ((const char *)this->m_data.constData (), this->m_data.length () * sizeof(quint32));
+	return result;
+}
+
+bool Reader::open (const uchar *data, qint64 size) {
+	if (size < qint64 (sizeof(FileHeader))) {
+		return false;
+	}
+	
+	FileHeader header;
+	memcpy (&header, data, sizeof(header));
+	if (memcmp (header.magic, fileMagic, sizeof(fileMagic)) != 0 ||
+	    header.version != DefsFile::Version || header.byteOrder != byteOrderMark) {
+		return false;
+	}
+	
+	// Check that all sections are inside the file
+	if (header.stringCount < 1 || header.stringTable % 4 != 0 || header.data % 4 != 0 ||
+	    header.stringTable + qint64 (header.stringCount) * sizeof(StringEntry) > size ||
+	    header.data + qint64 (header.dataWords) * sizeof(quint32) > size) {
+		return false;
+	}
+	
+	const StringEntry *strings = reinterpret_cast< const StringEntry * > (data + header.stringTable);
+	for (quint32 i = 0; i < header.stringCount; i++) {
+		if (qint64 (strings[i].offset) + strings[i].length >= size ||
+		    data[strings[i].offset + strings[i].length] != '\0') {
+			return false;
+		}
+		
+	}
+	
+	// 
+	this->m_base = data;
+	this->m_strings = strings;
+	this->m_stringCount = header.stringCount;
+	this->m_pos = reinterpret_cast< const quint32 * > (data + header.data);
+	this->m_end = this->m_pos + header.dataWords;
+	this->m_symbols.resize (header.stringCount);
+	this->m_valid = true;
+	return true;
+}
+
+int Reader::count () {
+	
+	// Each element takes at least one word
+	quint32 result = word ();
+	if (result > quint32 (this->m_end - this->m_pos)) {
+		this->m_valid = false;
+		this->m_pos = this->m_end;
+		return 0;
+	}
+	
+	return int (result);
+}
+
+quint32 Reader::stringIndex () {
+	quint32 index = word ();
+	if (index >= this->m_stringCount) {
+		this->m_valid = false;
+		return 0;
+	}
+	
+	return index;
+}
+
+Symbol Reader::symbol () {
+	quint32 index = stringIndex ();
+	const StringEntry &entry = this->m_strings[index];
+	Symbol &symbol = this->m_symbols[index];
+	
+	// Each string is only interned once
+	if (symbol.isEmpty () && entry.length > 0) {
+		const char *data = reinterpret_cast< const char * > (this->m_base + entry.offset);
+		symbol = Symbol::fromId (SymbolTable::instance ()->intern (data, entry.length));
+	}
+	
+	return symbol;
+}
+
+QString Reader::string () {
+	const StringEntry &entry = this->m_strings[stringIndex ()];
+	return QString::fromUtf8 (reinterpret_cast< const char * > (this->m_base + entry.offset), entry.length);
+}
+
+clang::SourceLocation Reader::location () {
+	quint32 file = stringIndex ();
+	quint32 line = word ();
+	quint32 column = word ();
+	
+	if (file == 0 || line == 0) {
+		return clang::SourceLocation ();
+	}
+	
+	// Files which don't exist anymore have no locations
+	auto it = this->m_files.constFind (file);
+	if (it == this->m_files.constEnd ()) {
+		const StringEntry &entry = this->m_strings[file];
+		llvm::StringRef path (reinterpret_cast< const char * > (this->m_base + entry.offset), entry.length);
+		const clang::FileEntry *fileEntry = this->m_sm.getFileManager ().getFile (path);
+		
+		clang::FileID fileId;
+		if (fileEntry) {
+			fileId = this->m_sm.createFileID (fileEntry, clang::SourceLocation (), clang::SrcMgr::C_User);
+		}
+		
+		it = this->m_files.insert (file, fileId);
+	}
+	
+	if (it->isInvalid ()) {
+		return clang::SourceLocation ();
+	}
+	
+	return this->m_sm.translateLineCol (*it, line, column);
+}
+
+clang::SourceRange Reader::range () {
+	clang::SourceLocation begin = location ();
+	return clang::SourceRange (begin, location ());
+}
+
+Annotations Reader::annotations () {
+	Annotations result;
+	int n = count ();
+	result.reserve (n);
+	
+	for (int i = 0; i < n; i++) {
+		AnnotationDef cur;
+		cur.loc = range ();
+		cur.type = AnnotationType (word ());
+		cur.name = symbol ();
+		cur.value = string ();
+		cur.valueType = QMetaType::Type (word ());
+		cur.index = int (word ());
+		result.append (cur);
+	}
+	
+	return result;
+}
+
+VariableDef Reader::variable () {
+	VariableDef variable;
+	variable.loc = range ();
+	variable.access = clang::AccessSpecifier (word ());
+	variable.name = symbol ();
+	variable.type = symbol ();
+	variable.getter = symbol ();
+	variable.setterArgName = symbol ();
+	variable.setter = symbol ();
+	variable.annotations = annotations ();
+	
+	quint32 bits = word ();
+	variable.isReference = bits & 1;
+	variable.isConst = bits & 2;
+	variable.isPodType = bits & 4;
+	variable.isOptional = bits & 8;
+	variable.setterReturnsBool = bits & 16;
+	return variable;
+}
+
+MethodDef Reader::method () {
+	MethodDef method;
+	method.loc = range ();
+	method.access = clang::AccessSpecifier (word ());
+	method.type = MethodType (word ());
+	
+	quint32 bits = word ();
+	method.isVirtual = bits & 1;
+	method.isPure = bits & 2;
+	method.isConst = bits & 4;
+	method.hasOptionalArguments = bits & 8;
+	
+	method.name = symbol ();
+	method.returnType = variable ();
+	
+	int n = count ();
+	method.arguments.reserve (n);
+	for (int i = 0; i < n; i++) {
+		method.arguments.append (variable ());
+	}
+	
+	method.annotations = annotations ();
+	return method;
+}
+
+ClassDef Reader::classDef () {
+	ClassDef def;
+	def.access = clang::AccessSpecifier (word ());
+	def.loc = range ();
+	def.name = symbol ();
+	def.file = symbol ();
+	
+	int n = count ();
+	def.bases.reserve (n);
+	for (int i = 0; i < n; i++) {
+		BaseDef base;
+		base.access = clang::AccessSpecifier (word ());
+		base.loc = range ();
+		base.isVirtual = word ();
+		base.name = symbol ();
+		def.bases.append (base);
+	}
+	
+	n = count ();
+	def.variables.reserve (n);
+	for (int i = 0; i < n; i++) {
+		def.variables.append (variable ());
+	}
+	
+	n = count ();
+	def.methods.reserve (n);
+	for (int i = 0; i < n; i++) {
+		def.methods.append (method ());
+	}
+	
+	n = count ();
+	def.enums.reserve (n);
+	for (int i = 0; i < n; i++) {
+		EnumDef cur;
+		cur.loc = range ();
+		cur.name = symbol ();
+		
+		int elements = count ();
+		for (int j = 0; j < elements; j++) {
+			QString key = string ();
+			cur.elements.insert (key, int (word ()));
+		}
+		
+		cur.annotations = annotations ();
+		def.enums.append (cur);
+	}
+	
+	n = count ();
+	def.conversions.reserve (n);
+	for (int i = 0; i < n; i++) {
+		ConversionDef cur;
+		cur.loc = range ();
+		cur.methodName = symbol ();
+		cur.type = MethodType (word ());
+		cur.fromType = symbol ();
+		cur.toType = symbol ();
+		cur.isConst = word ();
+		def.conversions.append (cur);
+	}
+	
+	def.annotations = annotations ();
+	
+	quint32 bits = word ();
+	def.isFakeClass = bits & 1;
+	def.hasValueSemantics = bits & 2;
+	def.hasDefaultCtor = bits & 4;
+	def.hasCopyCtor = bits & 8;
+	def.hasAssignmentOperator = bits & 16;
+	def.implementsCtor = bits & 32;
+	def.implementsCopyCtor = bits & 64;
+	def.hasPureVirtuals = bits & 128;
+	return def;
+}
+
+int Reader::position (int classCount) {
+	quint32 result = word ();
+	if (result >= quint32 (classCount)) {
+		this->m_valid = false;
+		return 0;
+	}
+	
+	return int (result);
+}
+
+void Reader::positionsMap (QHash< Symbol, DefinitionIndex::Positions > &map, int classCount) {
+	int n = count ();
+	map.reserve (n);
+	
+	for (int i = 0; i < n && this->m_valid; i++) {
+		Symbol key = symbol ();
+		DefinitionIndex::Positions &positions = map[key];
+		
+		int length = count ();
+		positions.reserve (length);
+		for (int j = 0; j < length; j++) {
+			positions.append (position (classCount));
+		}
+		
+	}
+	
+}
+
+bool DefsFile::write (const QString &path, const Definitions &definitions, clang::SourceManager *sm) {
+	Writer writer (sm);
+	
+	QStringList sourceFiles = definitions.sourceFiles ();
+	writer.word (sourceFiles.length ());
+	for (const QString &cur : sourceFiles) {
+		writer.string (cur);
+	}
+	
+	writer.word (definitions.declaredTypes ().size ());
+	for (const QString &cur : sortedValues (definitions.declaredTypes ())) {
+		writer.string (cur);
+	}
+	
+	const QMap< QString, bool > &declareTypes = definitions.declareTypes ();
+	writer.word (declareTypes.size ());
+	for (auto it = declareTypes.constBegin (), end = declareTypes.constEnd (); it != end; ++it) {
+		writer.string (it.key ());
+		writer.word (it.value ());
+	}
+	
+	writer.word (definitions.avoidedTypes ().size ());
+	for (const QString &cur : sortedValues (definitions.avoidedTypes ())) {
+		writer.string (cur);
+	}
+	
+	const StringMap &typedefs = definitions.typedefs ();
+	writer.word (typedefs.size ());
+	for (auto it = typedefs.constBegin (), end = typedefs.constEnd (); it != end; ++it) {
+		writer.string (it.key ());
+		writer.string (it.value ());
+	}
+	
+	const QVector< ClassDef > &classes = definitions.classDefintions ();
+	writer.word (classes.length ());
+	for (const ClassDef &cur : classes) {
+		writer.classDef (cur);
+	}
+	
+	// The index is stored too, so readers don't have to rebuild it
+	const DefinitionIndex &index = definitions.index ();
+	writer.word (index.names ().size ());
+	for (const Symbol &cur : sortedKeys (index.names ())) {
+		writer.symbol (cur);
+		writer.word (index.names ().value (cur));
+	}
+	
+	writer.positionsMap (index.files ());
+	writer.positionsMap (index.annotations ());
+	writer.positionsMap (index.bases ());
+	writer.positionsMap (index.derived ());
+	
+	// 
+	QByteArray data = writer.finish ();
+	QSaveFile file (path);
+	if (!file.open (QIODevice::WriteOnly) || file.write (data) != data.length () || !file.commit ()) {
+		qCritical() << "Failed to write definitions to" << path;
+		return false;
+	}
+	
+	return true;
+}
+
+bool DefsFile::read (const QString &path, Definitions &definitions, clang::SourceManager &sm) {
+	QFile file (path);
+	if (!file.open (QIODevice::ReadOnly)) {
+		qCritical() << "Failed to open" << path;
+		return false;
+	}
+	
+	const uchar *data = file.map (0, file.size ());
+	Reader reader (sm);
+	if (!data || !reader.open (data, file.size ())) {
+		qCritical() << path << "is not a definitions file of this version of tria";
+		return false;
+	}
+	
+	// Classes have been cleaned up before they were written, so they're
+	// stored as they are.
+	int n = reader.count ();
+	definitions.m_fileNames.clear ();
+	for (int i = 0; i < n; i++) {
+		definitions.m_fileNames.append (reader.string ());
+	}
+	
+	n = reader.count ();
+	for (int i = 0; i < n; i++) {
+		definitions.addDeclaredType (reader.string ());
+	}
+	
+	n = reader.count ();
+	for (int i = 0; i < n; i++) {
+		QString type = reader.string ();
+		definitions.m_declareTypes.insert (type, reader.word ());
+	}
+	
+	n = reader.count ();
+	for (int i = 0; i < n; i++) {
+		definitions.avoidType (reader.string ());
+	}
+	
+	n = reader.count ();
+	for (int i = 0; i < n; i++) {
+		QString typeDef = reader.string ();
+		definitions.m_typeDefs.insert (typeDef, reader.string ());
+	}
+	
+	n = reader.count ();
+	int first = definitions.m_classes.length ();
+	definitions.m_classes.reserve (first + n);
+	for (int i = 0; i < n && reader.isValid (); i++) {
+		definitions.m_classes.append (reader.classDef ());
+	}
+	
+	// 
+	DefinitionIndex index;
+	int names = reader.count ();
+	index.m_names.reserve (names);
+	for (int i = 0; i < names && reader.isValid (); i++) {
+		Symbol name = reader.symbol ();
+		index.m_names.insert (name, reader.position (n));
+	}
+	
+	reader.positionsMap (index.m_files, n);
+	reader.positionsMap (index.m_annotations, n);
+	reader.positionsMap (index.m_bases, n);
+	reader.positionsMap (index.m_derived, n);
+	
+	// Positions are only valid if the file was read into empty definitions
+	definitions.m_indexValid = (first == 0);
+	if (first == 0) {
+		definitions.m_index = index;
+	}
+	
+	if (!reader.isValid () || !reader.atEnd ()) {
+		qCritical() << path << "is corrupt";
+		return false;
+	}
+	
+	return true;
+}
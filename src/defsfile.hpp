@@ -0,0 +1,60 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEFSFILE_HPP
+#define DEFSFILE_HPP
+
+#include <QString>
+
+namespace clang {
+class SourceManager;
+}
+
+class Definitions;
+
+/**
+ * Binary file of Definitions, as written by "-emit-defs" and read by
+ * "-from-defs". This allows to run generators without parsing anything.
+ * 
+ * The file starts with a header, followed by a table of all strings and the
+ * definitions as sequence of 32-bit words. Strings are referred to by their
+ * index in the table, and all offsets are relative to the start of the file,
+ * so it can be mapped into memory at any address. Source locations are
+ * stored as file, line and column. The DefinitionIndex is stored at the end.
+ */
+class DefsFile {
+public:
+	
+	/** Current version of the format. Files of other versions are rejected. */
+	enum { Version = 2 };
+	
+	/**
+	 * Writes \a definitions to \a path. Source locations are resolved
+	 * using \a sm, if it's \c nullptr, they're left out.
+	 */
+	static bool write (const QString &path, const Definitions &definitions,
+	                   clang::SourceManager *sm);
+	
+	/**
+	 * Maps \a path into memory and reads it into \a definitions. Source
+	 * locations are recreated in \a sm for all files which still exist.
+	 * Returns \c false if the file can't be read or is not valid.
+	 */
+	static bool read (const QString &path, Definitions &definitions, clang::SourceManager &sm);
+	
+};
+
+#endif // DEFSFILE_HPP
@@ -0,0 +1,125 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "depfile.hpp"
+
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Basic/FileManager.h>
+
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+#include <QSet>
+
+#include "compiler.hpp"
+#include "pchcache.hpp"
+
+static bool isDependency (const QString &path) {
+	return (!path.startsWith (QLatin1String ("/builtins/")) && QFileInfo (path).isFile ());
+}
+
+QStringList DepFile::dependencies (Compiler &compiler, const QVector< GenConf > &generators) {
+	QSet< QString > seen;
+	QStringList files;
+	
+	auto add = [&seen, &files](const QString &path) {
+		if (!seen.contains (path) && isDependency (path)) {
+			seen.insert (path);
+			files.append (path);
+		}
+		
+	};
+	
+	// Everything the source manager has loaded. This includes headers
+	// skipped by their include guard, as these were read before.
+	clang::CompilerInstance *ci = compiler.compiler ();
+	if (ci->hasSourceManager ()) {
+		clang::SourceManager &sm = ci->getSourceManager ();
+		for (auto it = sm.fileinfo_begin (), end = sm.fileinfo_end (); it != end; ++it) {
+			add (QString::fromUtf8 (it->first->getName ()));
+		}
+		
+	}
+	
+	// Headers in the PCH may not have been touched by the run at all
+	std::shared_ptr< const PchInfo > pch = compiler.pch ();
+	if (pch) {
+		for (const QString &cur : pch->dependencies) {
+			add (cur);
+		}
+		
+	}
+	
+	// Custom generator scripts
+	for (const GenConf &cur : generators) {
+		if (!cur.luaScript.startsWith (QLatin1String (":/")) && cur.luaScript != QLatin1String ("SHELL")) {
+			add (cur.luaScript);
+		}
+		
+	}
+	
+	return files;
+}
+
+QString DepFile::target (const QVector< GenConf > &generators) {
+	for (const GenConf &cur : generators) {
+		if (cur.luaScript == QLatin1String ("SHELL") || cur.outFile == QLatin1String ("-")) {
+			continue;
+		}
+		
+		// "+path" appends to path
+		return cur.outFile.startsWith (QLatin1Char ('+')) ? cur.outFile.mid (1) : cur.outFile;
+	}
+	
+	return QString ();
+}
+
+static QByteArray escape (const QString &path) {
+	QByteArray data = path.toUtf8 ();
+	QByteArray result;
+	
+	for (char c : data) {
+		if (c == ' ' || c == '#') {
+			result.append ('\\');
+		} else if (c == '$') {
+			result.append ('$');
+		}
+		
+		result.append (c);
+	}
+	
+	return result;
+}
+
+bool DepFile::write (const QString &path, const QString &target, const QStringList &dependencies) {
+	QByteArray data = escape (target) + ":";
+	for (const QString &cur : dependencies) {
+		data.append (" \\\n  ");
+		data.append (escape (cur));
+	}
+	
+	data.append ('\n');
+	
+	// 
+	QSaveFile file (path);
+	if (!file.open (QIODevice::WriteOnly) || file.write (data) != data.length () || !file.commit ()) {
+		qCritical() << "Failed to write dependency file" << path;
+		return false;
+	}
+	
+	return true;
+}
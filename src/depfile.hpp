@@ -0,0 +1,59 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DEPFILE_HPP
+#define DEPFILE_HPP
+
+#include "luagenerator.hpp"
+
+#include <QStringList>
+#include <QString>
+#include <QVector>
+
+class Compiler;
+
+/**
+ * Writer of Makefile-style dependency files, as known from the -MD option
+ * of GCC. These are understood by make and Ninja (deps = gcc), which then
+ * only re-run tria if one of the listed files changes.
+ */
+class DepFile {
+public:
+	
+	/**
+	 * Returns the files the last run of \a compiler has read, including
+	 * those of its precompiled header, and the custom Lua scripts of
+	 * \a generators. Built-in headers and virtual files are left out.
+	 */
+	static QStringList dependencies (Compiler &compiler, const QVector< GenConf > &generators);
+	
+	/**
+	 * Returns the first file written by \a generators, which is the
+	 * target of the dependency file. Returns an empty string if all write
+	 * to stdout.
+	 */
+	static QString target (const QVector< GenConf > &generators);
+	
+	/**
+	 * Writes a dependency file to \a path, stating that \a target depends
+	 * on \a dependencies. The file is only replaced if it was written
+	 * completely.
+	 */
+	static bool write (const QString &path, const QString &target, const QStringList &dependencies);
+	
+};
+
+#endif // DEPFILE_HPP
@@ -17,56 +17,350 @@
 #include "filemapper.hpp"
 
 #include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Basic/VirtualFileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <clang/Basic/FileManager.h>
 #include <clang/Basic/Version.h>
 #include "compiler.hpp"
+#include <QResource>
+#include <QFileInfo>
+#include <QtEndian>
 #include <QString>
+#include <QFile>
 
-FileMapper::FileMapper () {
+#include <limits>
+
+#if CLANG_VERSION_MINOR >= 5
+
+// Serves the files of a FileMapper. All other paths are left to the file
+// system below it in the overlay.
+class MappedFileSystem : public clang::vfs::FileSystem {
+public:
+	
+	MappedFileSystem (const FileMapper *mapper)
+		: m_mapper (mapper)
+	{ }
+	
+	llvm::ErrorOr< clang::vfs::Status > status (const llvm::Twine &path) override;
+	
+#if CLANG_VERSION_MINOR < 6
+	std::error_code openFileForRead (const llvm::Twine &path, std::unique_ptr< clang::vfs::File > &result) override;
+#else
+	llvm::ErrorOr< std::unique_ptr< clang::vfs::File > > openFileForRead (const llvm::Twine &path) override;
+#endif
+
+	clang::vfs::directory_iterator dir_begin (const llvm::Twine &dir, std::error_code &error) override;
+	
+private:
+	const FileMapper::MappedFile *find (const llvm::Twine &path, QByteArray &name) const;
+	
+	const FileMapper *m_mapper;
+	
+};
+
+// A mapped file opened by Clang
+class MappedFileHandle : public clang::vfs::File {
+public:
+	
+	MappedFileHandle (const clang::vfs::Status &status, const FileMapper::MappedFile &file)
+		: m_status (status), m_file (file)
+	{ }
+	
+	llvm::ErrorOr< clang::vfs::Status > status () override {
+		return this->m_status;
+	}
+	
+#if CLANG_VERSION_MINOR < 6
+	std::error_code getBuffer (const llvm::Twine &name, std::unique_ptr< llvm::MemoryBuffer > &result,
+	                           int64_t, bool requiresNullTerminator, bool) override {
+		return createBuffer (name, requiresNullTerminator, result);
+	}
+#else
+	llvm::ErrorOr< std::unique_ptr< llvm::MemoryBuffer > > getBuffer (const llvm::Twine &name, int64_t,
+	                                                                 bool requiresNullTerminator, bool) override {
+		std::unique_ptr< llvm::MemoryBuffer > result;
+		std::error_code error = createBuffer (name, requiresNullTerminator, result);
+		if (error) {
+			return error;
+		}
+		
+		return std::move (result);
+	}
+#endif
+
+	std::error_code close () override {
+		return std::error_code ();
+	}
+	
+	void setName (llvm::StringRef name) override {
+		this->m_status.setName (name);
+	}
 	
+private:
+	
+	std::error_code createBuffer (const llvm::Twine &name, bool requiresNullTerminator,
+	                              std::unique_ptr< llvm::MemoryBuffer > &result);
+	
+	clang::vfs::Status m_status;
+	FileMapper::MappedFile m_file;
+	
+};
+
+// MemoryBuffer factories return raw pointers before Clang 3.6
+template< typename T >
+static std::unique_ptr< llvm::MemoryBuffer > ownBuffer (T buffer) {
+	return std::unique_ptr< llvm::MemoryBuffer > (std::move (buffer));
 }
 
-void FileMapper::mapRecursive (const QDir &directory, const QString &prefix) {
-	QStringList files = directory.entryList (QDir::Files);
-	QStringList dirs = directory.entryList (QDir::Dirs);
+static quint64 resourceSize (const QResource &resource) {
+	if (resource.isCompressed ()) { // qCompress() stores the size up front
+		return qFromBigEndian< quint32 > (resource.data ());
+	}
+	
+	return resource.size ();
+}
+
+std::error_code MappedFileHandle::createBuffer (const llvm::Twine &name, bool requiresNullTerminator,
+                                                std::unique_ptr< llvm::MemoryBuffer > &result) {
+	const FileMapper::MappedFile &file = this->m_file;
+	
+	switch (file.type) {
+	case FileMapper::MappedFile::Directory:
+		return std::make_error_code (std::errc::is_a_directory);
+		
+	case FileMapper::MappedFile::Data: {
+		// QByteArrays are always null-terminated
+		llvm::StringRef ref (file.data.constData (), file.data.length ());
+		result = ownBuffer (llvm::MemoryBuffer::getMemBuffer (ref, name.str (), requiresNullTerminator));
+	} break;
+	
+	case FileMapper::MappedFile::Resource: {
+		QResource resource (file.path);
+		if (resource.isCompressed ()) {
+			QByteArray data = qUncompress (resource.data (), resource.size ());
+			llvm::StringRef ref (data.constData (), data.length ());
+			result = ownBuffer (llvm::MemoryBuffer::getMemBufferCopy (ref, name));
+			break;
+		}
+		
+		// Resource data isn't null-terminated, which the lexer relies on
+		llvm::StringRef ref (reinterpret_cast< const char * > (resource.data ()), resource.size ());
+		if (requiresNullTerminator) {
+			result = ownBuffer (llvm::MemoryBuffer::getMemBufferCopy (ref, name));
+		} else {
+			result = ownBuffer (llvm::MemoryBuffer::getMemBuffer (ref, name.str (), false));
+		}
+		
+	} break;
 	
-	for (const QString &cur : dirs) {
-		QDir d = directory;
-		d.cd (cur);
-		mapRecursive (d, prefix + cur + QLatin1String("/"));
+	case FileMapper::MappedFile::File: {
+		// LLVM memory-maps files unless they're small
+		int64_t size = this->m_status.getSize ();
+		std::string path = file.path.toStdString ();
+		
+#if CLANG_VERSION_MINOR < 6
+		return llvm::MemoryBuffer::getFile (path, result, size, requiresNullTerminator);
+#else
+		llvm::ErrorOr< std::unique_ptr< llvm::MemoryBuffer > > buffer;
+		buffer = llvm::MemoryBuffer::getFile (path, size, requiresNullTerminator);
+		if (!buffer) {
+			return buffer.getError ();
+		}
+		
+		result = std::move (*buffer);
+#endif
+	} break;
+	}
+	
+	return std::error_code ();
+}
+
+const FileMapper::MappedFile *MappedFileSystem::find (const llvm::Twine &path, QByteArray &name) const {
+	name = QByteArray (path.str ().c_str ());
+	
+	// Relative paths are passed on with the working directory prepended
+	while (name.startsWith ("./")) {
+		name.remove (0, 2);
 	}
 	
-	for (const QString &cur : files) {
-		mapFile (directory.filePath (cur), prefix + cur);
+	if (name.endsWith ('/')) {
+		name.chop (1);
+	}
+	
+	auto it = this->m_mapper->m_files.constFind (name);
+	return (it == this->m_mapper->m_files.constEnd ()) ? nullptr : &*it;
+}
+
+llvm::ErrorOr< clang::vfs::Status > MappedFileSystem::status (const llvm::Twine &path) {
+	using namespace llvm::sys::fs;
+	
+	QByteArray name;
+	const FileMapper::MappedFile *file = find (path, name);
+	if (!file) {
+		return std::make_error_code (std::errc::no_such_file_or_directory);
+	}
+	
+	// Mapped data doesn't change while tria runs, nor between runs as far
+	// as a PCH is concerned.
+	UniqueID id (std::numeric_limits< uint64_t >::max () - 1, file->id);
+	llvm::sys::TimeValue modified;
+	modified.fromEpochTime (0);
+	
+	file_type type = file_type::regular_file;
+	perms permissions = all_read;
+	uint64_t size = 0;
+	
+	switch (file->type) {
+	case FileMapper::MappedFile::Directory:
+		type = file_type::directory_file;
+		permissions = all_read | all_exe;
+		break;
+	case FileMapper::MappedFile::Data:
+		size = file->data.length ();
+		break;
+	case FileMapper::MappedFile::Resource:
+		size = resourceSize (QResource (file->path));
+		break;
+	case FileMapper::MappedFile::File: {
+		llvm::ErrorOr< clang::vfs::Status > real = clang::vfs::getRealFileSystem ()->status (file->path.toStdString ());
+		if (!real) {
+			return real.getError ();
+		}
+		
+		size = real->getSize ();
+		modified = real->getLastModificationTime ();
+	} break;
+	}
+	
+	return clang::vfs::Status (name.constData (), name.constData (), id, modified, 0, 0, size, type, permissions);
+}
+
+#if CLANG_VERSION_MINOR < 6
+std::error_code MappedFileSystem::openFileForRead (const llvm::Twine &path,
+                                                   std::unique_ptr< clang::vfs::File > &result) {
+	llvm::ErrorOr< clang::vfs::Status > fileStatus = status (path);
+	if (!fileStatus) {
+		return fileStatus.getError ();
+	}
+	
+	QByteArray name;
+	const FileMapper::MappedFile *file = find (path, name);
+	
+	result.reset (new MappedFileHandle (*fileStatus, *file));
+	return std::error_code ();
+}
+#else
+llvm::ErrorOr< std::unique_ptr< clang::vfs::File > > MappedFileSystem::openFileForRead (const llvm::Twine &path) {
+	llvm::ErrorOr< clang::vfs::Status > fileStatus = status (path);
+	if (!fileStatus) {
+		return fileStatus.getError ();
+	}
+	
+	QByteArray name;
+	const FileMapper::MappedFile *file = find (path, name);
+	
+	return std::unique_ptr< clang::vfs::File > (new MappedFileHandle (*fileStatus, *file));
+}
+#endif
+
+clang::vfs::directory_iterator MappedFileSystem::dir_begin (const llvm::Twine &dir, std::error_code &error) {
+	
+	// Clang only iterates directories for modules, which tria doesn't use.
+	llvm::ErrorOr< clang::vfs::Status > dirStatus = status (dir);
+	error = dirStatus ? std::error_code () : dirStatus.getError ();
+	return clang::vfs::directory_iterator ();
+}
+
+#endif
+
+FileMapper::FileMapper () {
+	
+}
+
+void FileMapper::mapRecursive (const QDir &directory, const QString &prefix) {
+	QFileInfoList entries = directory.entryInfoList (QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+	
+	for (const QFileInfo &cur : entries) {
+		if (cur.isDir ()) {
+			mapRecursive (QDir (cur.filePath ()), prefix + cur.fileName () + QLatin1String("/"));
+		} else {
+			mapFile (cur.filePath (), prefix + cur.fileName ());
+		}
+		
 	}
 	
 }
 
 void FileMapper::mapFile (const QString &path, const QString &target) {
-	QFile file (path);
-	file.open (QIODevice::ReadOnly);
+	MappedFile file;
+	
+#if CLANG_VERSION_MINOR < 5
+	QFile handle (path);
+	handle.open (QIODevice::ReadOnly);
+	file.data = handle.readAll ();
+#else
+	file.type = path.startsWith (QLatin1String (":/")) ? MappedFile::Resource : MappedFile::File;
+	file.path = path;
+#endif
 	
-	mapByteArray (file.readAll (), target);
+	insert (target, file);
 }
 
 void FileMapper::mapByteArray (const QByteArray &data, const QString &target) {
-	this->m_files.insert (target.toLatin1 (), data);
+	MappedFile file;
+	file.data = data;
+	
+	insert (target, file);
+}
+
+void FileMapper::insert (const QString &target, MappedFile file) {
+	QByteArray name = target.toLatin1 ();
+	auto it = this->m_files.constFind (name);
+	file.id = (it != this->m_files.constEnd ()) ? it->id : quint64 (this->m_files.size () + 1);
+	
+#if CLANG_VERSION_MINOR < 5
+	if (file.type == MappedFile::Data) {
+		llvm::StringRef ref (file.data.constData (), file.data.length ());
+		file.buffer = std::shared_ptr< llvm::MemoryBuffer > (llvm::MemoryBuffer::getMemBuffer (ref));
+	}
+#endif
+	
+	this->m_files.insert (name, file);
+	
+	// Parent directories, like Clang does for remapped files
+	int slash = name.lastIndexOf ('/');
+	if (slash > 0 && !this->m_files.contains (name.left (slash))) {
+		MappedFile directory;
+		directory.type = MappedFile::Directory;
+		insert (QString::fromLatin1 (name.left (slash)), directory);
+	}
+	
+}
+
+clang::FileManager *FileMapper::createFileManager () const {
+#if CLANG_VERSION_MINOR < 5
+	return new clang::FileManager ({ "." });
+#else
+	llvm::IntrusiveRefCntPtr< clang::vfs::OverlayFileSystem > overlay;
+	overlay = new clang::vfs::OverlayFileSystem (clang::vfs::getRealFileSystem ());
+	overlay->pushOverlay (new MappedFileSystem (this));
+	return new clang::FileManager ({ "." }, overlay);
+#endif
 }
 
 void FileMapper::applyMapping (Compiler *compiler) {
-	clang::CompilerInvocation *invocation = compiler->invocation ();
+#if CLANG_VERSION_MINOR < 5
+	clang::PreprocessorOptions &opts = compiler->invocation ()->getPreprocessorOpts ();
+	opts.RetainRemappedFileBuffers = true;
 	
-	for (auto it = this->m_files.begin (), end = this->m_files.end (); it != end; ++it) {
-		llvm::StringRef name (it.key ().constData (), it.key ().length ());
-		llvm::StringRef data (it->constData (), it->length ());
+	for (auto it = this->m_files.constBegin (), end = this->m_files.constEnd (); it != end; ++it) {
+		if (it->type != MappedFile::Directory) {
+			llvm::StringRef name (it.key ().constData (), it.key ().length ());
+			opts.addRemappedFile (name, it->buffer.get ());
+		}
 		
-#if CLANG_VERSION_MINOR < 6
-		llvm::MemoryBuffer *input = llvm::MemoryBuffer::getMemBuffer (data);
-		invocation->getPreprocessorOpts ().addRemappedFile (name, input);
+	}
 #else
-		std::unique_ptr< llvm::MemoryBuffer > input (llvm::MemoryBuffer::getMemBuffer (data));
-		invocation->getPreprocessorOpts ().addRemappedFile (name, input.get());
+	Q_UNUSED(compiler)
 #endif
-	}
-	
 }
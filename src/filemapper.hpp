@@ -19,24 +19,81 @@
 
 #include <clang/Tooling/Tooling.h>
 #include <QByteArray>
+#include <memory>
 #include <QDir>
 #include <QMap>
 
+namespace llvm {
+class MemoryBuffer;
+}
+
+namespace clang {
+class FileManager;
+}
+
+class MappedFileSystem;
+class MappedFileHandle;
 class Compiler;
+
+/**
+ * Makes files available to Clang under another path, or files which don't
+ * exist on disk at all. Mapped files are served by a virtual file system
+ * laid over the real one. They're only read once Clang opens them.
+ */
 class FileMapper {
 public:
 	
 	FileMapper ();
 	
+	/**
+	 * Maps all files in \a directory and its sub-directories to
+	 * \a prefix. \a directory may be a resource directory.
+	 */
 	void mapRecursive (const QDir &directory, const QString &prefix);
+	
+	/**
+	 * Maps the file at \a path to \a target. Resources are served straight
+	 * out of the resource data, other files are memory-mapped.
+	 */
 	void mapFile (const QString &path, const QString &target);
+	
+	/** Maps \a data to \a target. */
 	void mapByteArray (const QByteArray &data, const QString &target);
 	
+	/**
+	 * Creates a file manager which sees the mapped files on top of the real
+	 * file system. Compilers prepare()'d with this mapper use it by default.
+	 */
+	clang::FileManager *createFileManager () const;
+	
+	/**
+	 * Clang 3.4 lacks a virtual file system. There, all mapped files are
+	 * read right away and remapped in the invocation of \a compiler.
+	 */
 	void applyMapping (Compiler *compiler);
 	
 private:
+	friend class MappedFileSystem;
+	friend class MappedFileHandle;
+	
+	struct MappedFile {
+		enum Type { Directory, Data, Resource, File };
+		
+		Type type = Data;
+		quint64 id = 0;
+		QByteArray data;
+		QString path;
+		
+		// Clang 3.4 only
+		std::shared_ptr< llvm::MemoryBuffer > buffer;
+	};
+	
+	void insert (const QString &target, MappedFile file);
 	
-	QMap< QByteArray, QByteArray > m_files;
+	// By target path. Parent directories of mapped files are added as
+	// well. The data is owned by the mapper, so it survives multiple runs
+	// of a compiler and can be shared between compilers.
+	QMap< QByteArray, MappedFile > m_files;
 	
 };
 
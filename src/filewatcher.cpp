@@ -0,0 +1,166 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "filewatcher.hpp"
+
+#include <QFileInfo>
+#include <QThread>
+#include <QDebug>
+#include <QSet>
+
+#ifdef Q_OS_LINUX
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <poll.h>
+#endif
+
+// Time to wait for further changes after the first one
+static const int settleTime = 50;
+
+FileWatcher::FileWatcher () {
+#ifdef Q_OS_LINUX
+	this->m_inotify = ::inotify_init1 (IN_CLOEXEC);
+	if (this->m_inotify == -1) {
+		qWarning() << "Failed to initialize inotify, falling back to polling";
+	}
+	
+#endif
+}
+
+FileWatcher::~FileWatcher () {
+#ifdef Q_OS_LINUX
+	if (this->m_inotify != -1) {
+		::close (this->m_inotify);
+	}
+	
+#endif
+}
+
+void FileWatcher::setFiles (const QStringList &files, const QDateTime &readSince) {
+	QSet< QString > directories;
+	this->m_files.clear ();
+	
+	// Modification times may only have a resolution of seconds
+	QDateTime since = readSince.addMSecs (-readSince.time ().msec ());
+	
+	// Files modified since they were read are reported right away, by
+	// using an invalid time.
+	for (const QString &cur : files) {
+		QFileInfo info (cur);
+		QDateTime modified = info.lastModified ();
+		if (readSince.isValid () && modified >= since) {
+			modified = QDateTime ();
+		}
+		
+		this->m_files.insert (info.absoluteFilePath (), modified);
+		directories.insert (info.absolutePath ());
+	}
+	
+#ifdef Q_OS_LINUX
+	if (this->m_inotify == -1) {
+		return;
+	}
+	
+	// Watch descriptors of already watched directories are handed out again
+	for (auto it = this->m_directories.constBegin (); it != this->m_directories.constEnd (); ++it) {
+		if (!directories.contains (it.value ())) {
+			::inotify_rm_watch (this->m_inotify, it.key ());
+		}
+		
+	}
+	
+	this->m_directories.clear ();
+	for (const QString &cur : directories) {
+		uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB;
+		int wd = ::inotify_add_watch (this->m_inotify, QFile::encodeName (cur).constData (), mask);
+		if (wd != -1) {
+			this->m_directories.insert (wd, cur);
+		}
+		
+	}
+	
+#endif
+}
+
+QStringList FileWatcher::changedFiles () {
+	QStringList changed;
+	for (auto it = this->m_files.begin (); it != this->m_files.end (); ++it) {
+		QDateTime modified = QFileInfo (it.key ()).lastModified ();
+		if (modified != it.value ()) {
+			it.value () = modified;
+			changed.append (it.key ());
+		}
+		
+	}
+	
+	return changed;
+}
+
+#ifdef Q_OS_LINUX
+// Reads all pending events of \a fd. Returns \c false on error.
+static bool drainEvents (int fd) {
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	
+	pollfd pfd = { fd, POLLIN, 0 };
+	while (::poll (&pfd, 1, 0) > 0) {
+		if (::read (fd, buffer, sizeof(buffer)) <= 0) {
+			return false;
+		}
+		
+	}
+	
+	return true;
+}
+#endif
+
+QStringList FileWatcher::wait () {
+	QStringList changed = changedFiles ();
+	
+	while (changed.isEmpty ()) {
+#ifdef Q_OS_LINUX
+		if (this->m_inotify != -1) {
+			
+			// Events only tell that something happened in a directory.
+			// What has changed is found by comparing modification times.
+			pollfd pfd = { this->m_inotify, POLLIN, 0 };
+			if (::poll (&pfd, 1, -1) < 1 || !drainEvents (this->m_inotify)) {
+				return QStringList ();
+			}
+			
+			// Let the editor finish saving
+			while (::poll (&pfd, 1, settleTime) > 0) {
+				if (!drainEvents (this->m_inotify)) {
+					return QStringList ();
+				}
+				
+			}
+			
+			changed = changedFiles ();
+			continue;
+		}
+		
+#endif
+		QThread::msleep (250);
+		changed = changedFiles ();
+		if (!changed.isEmpty ()) {
+			QThread::msleep (settleTime);
+			changed.append (changedFiles ());
+		}
+		
+	}
+	
+	return changed;
+}
@@ -0,0 +1,60 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILEWATCHER_HPP
+#define FILEWATCHER_HPP
+
+#include <QStringList>
+#include <QDateTime>
+#include <QHash>
+
+/**
+ * Watches files for changes. On Linux, inotify is used on the directories of
+ * the files, so editors replacing a file on save are noticed too. Elsewhere,
+ * the modification times are polled.
+ */
+class FileWatcher {
+public:
+	
+	FileWatcher ();
+	~FileWatcher ();
+	
+	/**
+	 * Replaces the watched files by \a files. If \a readSince is valid,
+	 * files modified at or after it are reported as changed by the next
+	 * wait(), as they may have changed after they were read.
+	 */
+	void setFiles (const QStringList &files, const QDateTime &readSince = QDateTime ());
+	
+	/**
+	 * Blocks until at least one watched file has changed, and returns all
+	 * changed files. Changes following shortly after are collected too, so
+	 * a save touching multiple files results in one call. Returns an empty
+	 * list on error.
+	 */
+	QStringList wait ();
+	
+private:
+	
+	QStringList changedFiles ();
+	
+	QHash< QString, QDateTime > m_files;
+	QHash< int, QString > m_directories;
+	int m_inotify = -1;
+	
+};
+
+#endif // FILEWATCHER_HPP
@@ -16,10 +16,15 @@
 
 #include "luagenerator.hpp"
 
+#include <QCryptographicHash>
 #include <QJsonDocument>
+#include <QDirIterator>
 #include <QDateTime>
+#include <QSaveFile>
+#include <QBuffer>
 #include <memory>
 #include <QDebug>
+#include <QHash>
 #include <QFile>
 
 #include <clang/Frontend/CompilerInstance.h>
@@ -27,10 +32,13 @@
 #include "definitions.hpp"
 #include "compiler.hpp"
 #include "luashell.hpp"
+#include "luaproxy.hpp"
 #include <lua.hpp>
 #include <cstdio>
 
-#define METATABLE_SOURCERANGE "clang::SourceRange"
+#define REGISTRY_ENVIRONMENT "tria.environment"
+#define REGISTRY_OUTPUT "tria.output"
+#define REGISTRY_BUILTIN_MODULES "tria.builtinModules"
 
 #if 0
 static void dumpStack (lua_State *lua) {
@@ -51,12 +59,66 @@ static void dumpStack (lua_State *lua) {
 }
 #endif
 
+// Byte-code of the built-in scripts. See precompileBuiltinScripts().
+static QHash< QString, QByteArray > precompiledScripts;
+
+namespace {
+
+// Collects the output of a generator, and writes it to the out-file in
+// chunks of at least chunkSize bytes.
+class OutputBuffer {
+public:
+	
+	OutputBuffer (QIODevice *device, int chunkSize)
+		: m_device (device), m_chunkSize (chunkSize)
+	{
+		
+		this->m_buffer.reserve (chunkSize);
+		
+	}
+	
+	void append (const char *data, size_t length) {
+		this->m_buffer.append (data, int (length));
+		if (this->m_buffer.length () >= this->m_chunkSize) {
+			flush ();
+		}
+		
+	}
+	
+	bool flush () {
+		if (!this->m_buffer.isEmpty () &&
+		    this->m_device->write (this->m_buffer) != this->m_buffer.length ()) {
+			this->m_failed = true;
+		}
+		
+		// Keeps the reserved capacity
+		this->m_buffer.resize (0);
+		return !this->m_failed;
+	}
+	
+private:
+	QIODevice *m_device;
+	QByteArray m_buffer;
+	int m_chunkSize;
+	bool m_failed = false;
+	
+};
+
+}
+
 LuaGenerator::LuaGenerator (Definitions *definitions, Compiler *compiler)
 	: m_definitions (definitions), m_compiler (compiler)
 {
 	
 }
 
+LuaGenerator::~LuaGenerator () {
+	if (this->m_lua) {
+		lua_close (this->m_lua);
+	}
+	
+}
+
 bool LuaGenerator::parseConfig (const std::string &string, GenConf &config) {
 	size_t delim = string.find (':');
 	if (delim == std::string::npos) {
@@ -117,7 +179,88 @@ bool LuaGenerator::generate (const GenConf &config) {
 	}
 	
 	// 
-	return runScript (config, scriptData, &outHandle);
+	if (!runScript (config, scriptData, &outHandle)) {
+		outHandle.remove ();
+		return false;
+	}
+	
+	return true;
+}
+
+bool LuaGenerator::generate (const GenConf &config, QByteArray &output) {
+	QByteArray scriptData;
+	if (!loadScript (config.luaScript, scriptData)) {
+		return false;
+	}
+	
+	// 
+	QBuffer buffer (&output);
+	buffer.open (QIODevice::WriteOnly);
+	return runScript (config, scriptData, &buffer);
+}
+
+bool LuaGenerator::writeOutput (const QString &outFile, const QByteArray &data) {
+	QFile outHandle;
+	if (!openFileOrStdout (&outHandle, outFile)) {
+		qCritical() << "Lua: failed to open outfile" << outFile;
+		return false;
+	}
+	
+	return (outHandle.write (data) == data.length ());
+}
+
+static bool hasContent (const QString &path, const QByteArray &data) {
+	QFile file (path);
+	if (file.size () != data.length () || !file.open (QIODevice::ReadOnly)) {
+		return false;
+	}
+	
+	QCryptographicHash hash (QCryptographicHash::Sha1);
+	if (!hash.addData (&file)) {
+		return false;
+	}
+	
+	return (hash.result () == QCryptographicHash::hash (data, QCryptographicHash::Sha1));
+}
+
+bool LuaGenerator::updateOutput (const QString &outFile, const QByteArray &data, bool &changed) {
+	changed = true;
+	if (outFile == QLatin1String ("-") || outFile.startsWith (QLatin1Char ('+'))) {
+		return writeOutput (outFile, data);
+	}
+	
+	// Keep the file if it's up-to-date
+	if (hasContent (outFile, data)) {
+		changed = false;
+		return true;
+	}
+	
+	// Write to a temporary file which is then renamed
+	QSaveFile outHandle (outFile);
+	if (!outHandle.open (QIODevice::WriteOnly)) {
+		qCritical() << "Lua: failed to open outfile" << outFile;
+		return false;
+	}
+	
+	return (outHandle.write (data) == data.length () && outHandle.commit ());
+}
+
+bool LuaGenerator::allBuiltin (const QVector< GenConf > &generators) {
+	for (const GenConf &cur : generators) {
+		if (!cur.luaScript.startsWith (QLatin1String (":/"))) {
+			return false;
+		}
+		
+	}
+	
+	return true;
+}
+
+void LuaGenerator::removeOutput (const QString &outFile) {
+	if (outFile != QLatin1String ("-")) {
+		QFile::remove (outFile.startsWith (QLatin1Char ('+')) ? outFile.mid (1) : outFile);
+	}
+	
 }
 
 bool LuaGenerator::loadScript (const QString &path, QByteArray &code) {
@@ -127,6 +270,13 @@ bool LuaGenerator::loadScript (const QString &path, QByteArray &code) {
 		return true;
 	}
 	
+	// Already compiled?
+	auto it = precompiledScripts.constFind (path);
+	if (it != precompiledScripts.constEnd ()) {
+		code = *it;
+		return true;
+	}
+	
 	// Usual script file
 	QFile scriptFile (path);
 	if (!scriptFile.open (QIODevice::ReadOnly)) {
@@ -148,26 +298,107 @@ static void reportExecuteError (lua_State *lua, const QString &displayName) {
 }
 
 static inline bool executeByteArray (lua_State *lua, const QByteArray &code, const QString &displayName) {
-	bool r = loadFromByteArray (lua, code, displayName);
-	return (r && lua_pcall (lua, 0, 0, 0) == 0);
+	if (!loadFromByteArray (lua, code, displayName)) {
+		return false;
+	}
+	
+	// Run in the environment of the current generator
+	lua_getfield (lua, LUA_REGISTRYINDEX, REGISTRY_ENVIRONMENT);
+	lua_setfenv (lua, -2);
+	return (lua_pcall (lua, 0, 0, 0) == 0);
 }
 
-bool LuaGenerator::runScript (const GenConf &config, const QByteArray &script, QFile *outFile) {
-	std::unique_ptr< lua_State, decltype(&lua_close) > lua (lua_open (), &lua_close);
-	initState (lua.get (), config, outFile);
-	exportDefinitions (lua.get ());
+// Remembers the modules loaded by now, which are kept for all generators.
+static void storeBuiltinModules (lua_State *lua) {
+	lua_getglobal(lua, "package");
+	lua_getfield (lua, -1, "loaded");
+	lua_newtable (lua);
 	
-	// Execute script
-	if (config.luaScript == QLatin1String ("SHELL")) {
-		startShell (lua.get ());
-	} else if (!executeByteArray (lua.get (), script, config.luaScript)) {
-		reportExecuteError (lua.get (), config.luaScript);
-		outFile->remove ();
-		return false;
+	lua_pushnil (lua);
+	while (lua_next (lua, -3) != 0) {
+		lua_pop(lua, 1);
+		lua_pushvalue (lua, -1);
+		lua_pushboolean (lua, true);
+		lua_rawset (lua, -4);
+	}
+	
+	lua_setfield (lua, LUA_REGISTRYINDEX, REGISTRY_BUILTIN_MODULES);
+	lua_pop(lua, 2);
+}
+
+// Drops all other modules, so that the next generator loads them anew.
+static void unloadModules (lua_State *lua) {
+	lua_getglobal(lua, "package");
+	lua_getfield (lua, -1, "loaded");
+	lua_getfield (lua, LUA_REGISTRYINDEX, REGISTRY_BUILTIN_MODULES);
+	
+	lua_pushnil (lua);
+	while (lua_next (lua, -3) != 0) {
+		lua_pop(lua, 1);
+		lua_pushvalue (lua, -1);
+		lua_rawget (lua, -3);
+		bool builtin = lua_toboolean (lua, -1);
+		lua_pop(lua, 1);
+		
+		// Clearing existing fields is fine while traversing
+		if (!builtin) {
+			lua_pushvalue (lua, -1);
+			lua_pushnil (lua);
+			lua_rawset (lua, -5);
+		}
+		
 	}
 	
+	lua_pop(lua, 3);
+}
+
+bool LuaGenerator::runScript (const GenConf &config, const QByteArray &script, QIODevice *outFile) {
+	lua_State *lua = sharedState ();
+	bool isShell = (config.luaScript == QLatin1String ("SHELL"));
+	
+	// The shell is interactive, so don't hold back its output
+	OutputBuffer output (outFile, (isShell) ? 0 : 64 * 1024);
+	
 	// 
-	return true;
+	lua_settop (lua, 0);
+	createEnvironment (lua, config);
+	lua_setfield (lua, LUA_REGISTRYINDEX, REGISTRY_ENVIRONMENT);
+	lua_pushlightuserdata (lua, &output);
+	lua_setfield (lua, LUA_REGISTRYINDEX, REGISTRY_OUTPUT);
+	
+	// Execute script
+	bool success = true;
+	if (isShell) {
+		startShell (lua);
+	} else if (!executeByteArray (lua, script, config.luaScript)) {
+		reportExecuteError (lua, config.luaScript);
+		success = false;
+	}
+	
+	// Free the environment, and everything the script has created
+	lua_settop (lua, 0);
+	lua_pushnil (lua);
+	lua_setfield (lua, LUA_REGISTRYINDEX, REGISTRY_ENVIRONMENT);
+	lua_pushnil (lua);
+	lua_setfield (lua, LUA_REGISTRYINDEX, REGISTRY_OUTPUT);
+	unloadModules (lua);
+	lua_gc (lua, LUA_GCCOLLECT, 0);
+	
+	if (!output.flush ()) {
+		qCritical() << "Lua: failed to write outfile" << config.outFile;
+		success = false;
+	}
+	
+	return success;
+}
+
+lua_State *LuaGenerator::sharedState () {
+	if (!this->m_lua) {
+		this->m_lua = lua_open ();
+		initState (this->m_lua);
+	}
+	
+	return this->m_lua;
 }
 
 void LuaGenerator::startShell (lua_State *lua) {
@@ -175,29 +406,76 @@ void LuaGenerator::startShell (lua_State *lua) {
 	shell.run ();
 }
 
-void LuaGenerator::initState (lua_State *lua, const GenConf &config, QFile *file) {
+// Looks up global variables of the current generator, which are visible to
+// all code, including modules loaded by require().
+static int globalsFallback (lua_State *lua) {
+	lua_getfield (lua, LUA_REGISTRYINDEX, REGISTRY_ENVIRONMENT);
+	if (!lua_istable(lua, -1)) {
+		return 0;
+	}
+	
+	lua_pushvalue (lua, 2);
+	lua_rawget (lua, -2);
+	return 1;
+}
+
+// New globals of modules go into the environment of the current generator,
+// and are freed with it. Without a generator, they go into _G.
+static int globalsRedirect (lua_State *lua) {
+	lua_getfield (lua, LUA_REGISTRYINDEX, REGISTRY_ENVIRONMENT);
+	if (lua_istable(lua, -1)) {
+		lua_replace (lua, 1);
+	} else {
+		lua_pop(lua, 1);
+	}
+	
+	lua_rawset (lua, 1);
+	return 0;
+}
+
+void LuaGenerator::initState (lua_State *lua) {
 	luaL_openlibs (lua);
 	
 	// 
 	addLog (lua);
-	addWrite (lua, file);
 	addJson (lua);
+	addWrite (lua);
 	addLibLoader (lua);
-	addInformation (lua, config);
 	registerSourceRangeMetatable (lua);
+	LuaProxy::registerMetatable (lua);
+	
+	// _G falls back to the environment of the running generator, and
+	// modules write their globals into it.
+	lua_createtable (lua, 0, 2);
+	lua_pushcclosure (lua, &globalsFallback, 0);
+	lua_setfield (lua, -2, "__index");
+	lua_pushcclosure (lua, &globalsRedirect, 0);
+	lua_setfield (lua, -2, "__newindex");
+	lua_setmetatable (lua, LUA_GLOBALSINDEX);
+	storeBuiltinModules (lua);
+	
+	// The classes are the same for all generators, so export them once.
+	lua_createtable (lua, 0, 2);
+	exportClassDefinitions (lua);
+	exportIndex (lua);
+	this->m_sharedDefinitions = luaL_ref (lua, LUA_REGISTRYINDEX);
 	
 }
 
-static void pushSourceRange (lua_State *lua, const clang::SourceRange &range) {
-	
-	// Copy range to lua
-	void *ptr = lua_newuserdata (lua, sizeof(clang::SourceRange));
-	new (ptr) clang::SourceRange (range);
+void LuaGenerator::createEnvironment (lua_State *lua, const GenConf &config) {
+	lua_createtable (lua, 0, 3);
 	
-	// Set metatable
-	luaL_getmetatable(lua, METATABLE_SOURCERANGE);
+	// Globals of the script go into the environment, everything else is
+	// looked up in the shared _G.
+	lua_createtable (lua, 0, 1);
+	lua_pushvalue (lua, LUA_GLOBALSINDEX);
+	lua_setfield (lua, -2, "__index");
 	lua_setmetatable (lua, -2);
 	
+	// 
+	addInformation (lua, config);
+	exportDefinitions (lua);
+	
 }
 
 static inline void insertString (lua_State *lua, const char *name, const QString &string) {
@@ -205,14 +483,8 @@ static inline void insertString (lua_State *lua, const char *name, const QString
 	lua_setfield (lua, -2, name);
 }
 
-static inline void insertBool (lua_State *lua, const char *name, bool value) {
-	lua_pushboolean (lua, value);
-	lua_setfield (lua, -2, name);
-}
-
-static inline void insertSourceRange (lua_State *lua, const char *name, const clang::SourceRange &range) {
-	pushSourceRange (lua, range);
-	lua_setfield (lua, -2, name);
+static inline void pushSymbol (lua_State *lua, const Symbol &symbol) {
+	lua_pushlstring (lua, symbol.data (), symbol.length ());
 }
 
 void LuaGenerator::addInformation (lua_State *lua, const GenConf &config) {
@@ -232,12 +504,12 @@ void LuaGenerator::addInformation (lua_State *lua, const GenConf &config) {
 	insertString (lua, "outFile", config.outFile);
 	insertString (lua, "currentDateTime", QDateTime::currentDateTime ().toString (Qt::ISODate));
 	
-	lua_setfield (lua, LUA_GLOBALSINDEX, "tria");
+	lua_setfield (lua, -2, "tria");
 }
 
 static clang::SourceRange getSourceRangePointer (lua_State *lua, int pos) {
 	void *ptr = luaL_checkudata (lua, pos, METATABLE_SOURCERANGE);
-	luaL_argcheck(lua, ptr != nullptr, 1, METATABLE_SOURCERANGE " expected");
+	luaL_argcheck(lua, ptr != nullptr, pos, METATABLE_SOURCERANGE " expected");
 	
 	// 
 	return *(clang::SourceRange *)ptr;
@@ -250,12 +522,13 @@ static clang::SourceRange getSourceRangeTable (lua_State *lua, int pos) {
 	return result;
 }
 
-static clang::SourceRange getSourceRange (lua_State *lua) {
-	if (lua_istable(lua, 1)) {
-		return getSourceRangeTable (lua, 1);
+// Accepts a SourceRange, or a definition (table or proxy) with a "loc" field
+static clang::SourceRange getSourceRange (lua_State *lua, int pos) {
+	if (lua_istable(lua, pos) || LuaProxy::isProxy (lua, pos)) {
+		return getSourceRangeTable (lua, pos);
 	}
 	
-	return getSourceRangePointer (lua, 1);
+	return getSourceRangePointer (lua, pos);
 }
 
 static llvm::StringRef luaStringToStringRef (lua_State *lua, int idx) {
@@ -278,28 +551,13 @@ static bool logString (lua_State *lua, Compiler *compiler, clang::DiagnosticsEng
 	return false;
 }
 
-static clang::SourceRange *sourceRangePointer (lua_State *lua, int idx) {
-	void *ptr = nullptr;
-	
-	if (lua_istable(lua, idx)) {
-		lua_getfield (lua, idx, "loc");
-		ptr = luaL_checkudata (lua, -1, METATABLE_SOURCERANGE);
-		lua_pop(lua, 1);
-	} else {
-		ptr = luaL_checkudata (lua, 1, METATABLE_SOURCERANGE);
-	}
-	
-	// 
-	return (clang::SourceRange *)ptr;
-}
-
 static bool logRangeString (lua_State *lua, Compiler *compiler, clang::DiagnosticsEngine::Level level) {
 	if (!lua_isstring (lua, 2)) {
 		return false;
 	}
 	
 	// 
-	clang::SourceRange &range = *sourceRangePointer (lua, 1);
+	clang::SourceRange range = getSourceRange (lua, 1);
 	llvm::StringRef msg = luaStringToStringRef (lua, 2);
 	compiler->textDiag ()->emitDiagnostic (range.getBegin (), level, msg,
 	                                       llvm::ArrayRef< clang::CharSourceRange > (),
@@ -369,25 +627,62 @@ void LuaGenerator::addJson (lua_State *lua) {
 	lua_setfield (lua, LUA_GLOBALSINDEX, "json");
 }
 
-static int luaWrite (lua_State *lua) {
-	QFile *file = (QFile *)lua_topointer (lua, lua_upvalueindex(1));
-	if (lua_gettop (lua) != 1 || !lua_isstring (lua, 1)) {
-		return luaL_error (lua, "write() expects a single string argument.");
+// Arrays can contain arrays, but not infinitely deep
+enum { MaxWriteDepth = 32 };
+
+static void writeValue (lua_State *lua, OutputBuffer *output, int index, int depth) {
+	int type = lua_type (lua, index);
+	if (type == LUA_TSTRING || type == LUA_TNUMBER) {
+		size_t len = 0;
+		const char *str = lua_tolstring (lua, index, &len);
+		output->append (str, len);
+		return;
 	}
 	
 	// 
-	size_t len = 0;
-	const char *str = lua_tolstring (lua, 1, &len);
-	file->write (str, len);
+	if (type != LUA_TTABLE) {
+		luaL_error (lua, "write() expects strings, numbers or arrays of them.");
+	}
+	
+	if (depth >= MaxWriteDepth) {
+		luaL_error (lua, "write() expects arrays nested less than %d levels deep.", MaxWriteDepth);
+	}
+	
+	// Write all fragments without concatenating them first
+	luaL_checkstack (lua, 1, "write()");
+	int length = lua_objlen (lua, index);
+	for (int i = 1; i <= length; i++) {
+		lua_rawgeti (lua, index, i);
+		writeValue (lua, output, lua_gettop (lua), depth + 1);
+		lua_pop(lua, 1);
+	}
+	
+}
+
+// Writes to the output of the running generator. Scripts and modules may
+// keep a reference to write() around, so it must not point to an output
+// itself.
+static int luaWrite (lua_State *lua) {
+	lua_getfield (lua, LUA_REGISTRYINDEX, REGISTRY_OUTPUT);
+	OutputBuffer *output = static_cast< OutputBuffer * > (lua_touserdata (lua, -1));
+	lua_pop(lua, 1);
+	
+	if (!output) {
+		return luaL_error (lua, "write() can only be called while a generator is running.");
+	}
+	
+	int count = lua_gettop (lua);
 	
 	// 
-	return 0;
+	for (int i = 1; i <= count; i++) {
+		writeValue (lua, output, i, 0);
+	}
 	
+	return 0;
 }
 
-void LuaGenerator::addWrite (lua_State *lua, QFile *file) {
-	lua_pushlightuserdata (lua, file);
-	lua_pushcclosure (lua, luaWrite, 1);
+void LuaGenerator::addWrite (lua_State *lua) {
+	lua_pushcclosure (lua, luaWrite, 0);
 	lua_setfield (lua, LUA_GLOBALSINDEX, "write");
 	
 }
@@ -422,18 +717,27 @@ void LuaGenerator::registerSourceRangeMetatable (lua_State *lua) {
 
 void LuaGenerator::exportDefinitions (lua_State *lua) {
 	
-	// _G.definitions
-	lua_createtable (lua, 0, 4);
+	// definitions
+	lua_createtable (lua, 0, 8);
 	
-	// 
+	// Generators may change the lists of types, so each gets its own.
 	exportStringSet (lua, "declaredTypes", this->m_definitions->declaredTypes ());
 	exportStringBoolMap (lua, "declareTypes", this->m_definitions->declareTypes ());
 	exportStringSet (lua, "avoidedTypes", this->m_definitions->avoidedTypes ());
 	exportStringMap (lua, "typedefs", this->m_definitions->typedefs ());
-	exportClassDefinitions (lua);
+	exportStringLookup (lua, "declaredTypeSet", this->m_definitions->declaredTypes ());
+	exportStringLookup (lua, "avoidedTypeSet", this->m_definitions->avoidedTypes ());
+	
+	// Shared ones
+	lua_rawgeti (lua, LUA_REGISTRYINDEX, this->m_sharedDefinitions);
+	lua_getfield (lua, -1, "classes");
+	lua_setfield (lua, -3, "classes");
+	lua_getfield (lua, -1, "index");
+	lua_setfield (lua, -3, "index");
+	lua_pop(lua, 1);
 	
 	// 
-	lua_setfield (lua, LUA_GLOBALSINDEX, "definitions");
+	lua_setfield (lua, -2, "definitions");
 	
 }
 
@@ -450,6 +754,19 @@ void LuaGenerator::exportStringSet (lua_State *lua, const char *name, const Stri
 	lua_setfield (lua, -2, name);
 }
 
+void LuaGenerator::exportStringLookup (lua_State *lua, const char *name, const StringSet &set) {
+	lua_createtable (lua, 0, set.size ());
+	
+	for (auto it = set.constBegin (), end = set.constEnd (); it != end; ++it) {
+		lua_pushstring (lua, it->toLatin1 ().constData ());
+		lua_pushboolean (lua, true);
+		lua_rawset (lua, -3);
+	}
+	
+	// 
+	lua_setfield (lua, -2, name);
+}
+
 void LuaGenerator::exportStringMap (lua_State *lua, const char *name, const StringMap &map) {
 	lua_createtable (lua, 0, map.size ());
 	
@@ -489,308 +806,108 @@ void LuaGenerator::exportStringBoolMap (lua_State *lua, const char *name, const
 }
 
 void LuaGenerator::exportClassDefinitions (lua_State *lua) {
-	QVector< ClassDef > classes = this->m_definitions->classDefintions ();
+	const QVector< ClassDef > &classes = this->m_definitions->classDefintions ();
 	lua_createtable (lua, 0, classes.length ());
 	
 	// 
 	for (int i = 0; i < classes.length (); i++) {
-		exportClassDefinition (lua, classes.at (i));
+		pushSymbol (lua, classes.at (i).name);
+		LuaProxy::pushClass (lua, &classes.at (i));
+		lua_rawset (lua, -3);
 	}
 	
 	// 
 	lua_setfield (lua, -2, "classes");
 }
 
-void LuaGenerator::exportClassDefinition (lua_State *lua, const ClassDef &def) {
-	lua_pushstring (lua, def.name.toLatin1 ().constData ());
-	lua_createtable (lua, 0, 17);
+void LuaGenerator::exportIndex (lua_State *lua) {
+	const QVector< ClassDef > &classes = this->m_definitions->classDefintions ();
+	const DefinitionIndex &index = this->m_definitions->index ();
 	
-	// 
-	lua_pushvalue (lua, -2);
-	lua_setfield (lua, -2, "name");
-	
-	exportClassDefinitionBase (lua, def);
-	exportBases (lua, def.bases);
-	exportVariables (lua, "variables", def.variables);
-	exportMethods (lua, def.methods);
-	exportEnums (lua, def.enums);
-	exportAnnotations (lua, def.annotations);
-	exportConversions (lua, def.conversions);
-	
-	// 
-	lua_settable (lua, -3);
-}
-
-void LuaGenerator::exportClassDefinitionBase (lua_State *lua, const ClassDef &def) {
-	insertBool (lua, "hasValueSemantics", def.hasValueSemantics);
-	insertBool (lua, "hasDefaultCtor", def.hasDefaultCtor);
-	insertBool (lua, "hasCopyCtor", def.hasCopyCtor);
-	insertBool (lua, "hasAssignmentOperator", def.hasAssignmentOperator);
-	insertBool (lua, "implementsCtor", def.implementsCtor);
-	insertBool (lua, "implementsCopyCtor", def.implementsCopyCtor);
-	insertBool (lua, "isFakeClass", def.isFakeClass);
-	insertBool (lua, "hasPureVirtuals", def.hasPureVirtuals);
-	insertString (lua, "file", def.file);
-	insertSourceRange (lua, "loc", def.loc);
-}
-
-static void pushAccessSpecifier (lua_State *lua, clang::AccessSpecifier spec) {
-	switch (spec) {
-	case clang::AS_public:
-		lua_pushliteral(lua, "public");
-		break;
-        case clang::AS_protected:
-		lua_pushliteral(lua, "protected");
-		break;
-        case clang::AS_private:
-		lua_pushliteral(lua, "private");
-		break;
-        case clang::AS_none:
-		lua_pushliteral(lua, "none");
-		break;
-	default:
-		lua_pushnil (lua);
-	}
-	
-}
-
-void LuaGenerator::exportBases (lua_State *lua, const Bases &bases) {
-	lua_createtable (lua, 0, bases.length ());
-	
-	for (int i = 0; i < bases.length (); i++) {
-		const BaseDef &base = bases.at (i);
-		
-		lua_pushstring (lua, base.name.toLatin1 ().constData ());
-		lua_createtable (lua, 0, 3);
-		
-		insertBool (lua, "isVirtual", base.isVirtual);
-		insertSourceRange (lua, "loc", base.loc);
-		
-		pushAccessSpecifier (lua, base.access);
-		lua_setfield (lua, -2, "access");
-		
-		lua_settable (lua, -3);
-	}
-	
-	// 
-	lua_setfield (lua, -2, "bases");
-}
-
-static void pushAnnotationType (lua_State *lua, AnnotationType type) {
-	switch (type) {
-	case IntrospectAnnotation:
-		lua_pushliteral(lua, "introspect");
-		break;
-	case SkipAnnotation:
-		lua_pushliteral(lua, "skip");
-		break;
-	case ReadAnnotation:
-		lua_pushliteral(lua, "read");
-		break;
-	case WriteAnnotation:
-		lua_pushliteral(lua, "write");
-		break;
-	case RequireAnnotation:
-		lua_pushliteral(lua, "require");
-		break;
-	case CustomAnnotation:
-		lua_pushliteral(lua, "custom");
-		break;
-	default:
-		lua_pushnil (lua);
-	}
-	
-}
-
-void LuaGenerator::exportAnnotations (lua_State *lua, const Annotations &annotations) {
-	lua_createtable (lua, annotations.length (), 0);
-	for (int i = 0; i < annotations.length (); i++) {
-		const AnnotationDef &cur = annotations.at (i);
-		lua_createtable (lua, 0, 5);
-		
-		insertString (lua, "name", cur.name);
-		insertString (lua, "value", cur.value);
-		insertSourceRange (lua, "loc", cur.loc);
-		
-		pushAnnotationType (lua, cur.type);
-		lua_setfield (lua, -2, "type");
-		
-		lua_pushinteger (lua, cur.valueType);
-		lua_setfield (lua, -2, "valueType");
-		
-		const char *typeName = QMetaType::typeName (cur.valueType);
-		lua_pushlstring (lua, typeName ? typeName : "", typeName ? strlen (typeName) : 0);
-		lua_setfield (lua, -2, "typeName");
-		
+	// The index refers to the class tables by their position
+	lua_getfield (lua, -1, "classes");
+	lua_createtable (lua, classes.length (), 0);
+	for (int i = 0; i < classes.length (); i++) {
+		pushSymbol (lua, classes.at (i).name);
+		lua_rawget (lua, -3);
 		lua_rawseti (lua, -2, i + 1);
 	}
 	
-	// 
-	lua_setfield (lua, -2, "annotations");
-}
-
-static void pushMethodType (lua_State *lua, MethodType type) {
-	switch (type) {
-	case ConstructorMethod:
-		lua_pushliteral(lua, "constructor");
-		break;
-	case DestructorMethod:
-		lua_pushliteral(lua, "destructor");
-		break;
-	case MemberMethod:
-		lua_pushliteral(lua, "member");
-		break;
-	case StaticMethod:
-		lua_pushliteral(lua, "static");
-		break;
-	default:
-		lua_pushnil (lua);
-	}
-	
-}
-
-void LuaGenerator::exportVariables (lua_State *lua, const char *name, const Variables &variables) {
+	lua_remove (lua, -2);
 	
-	lua_createtable (lua, variables.length (), 0);
-	for (int i = 0; i < variables.length (); i++) {
-		pushVariable (lua, variables.at (i));
-		lua_rawseti (lua, -2, i + 1);
-	}
+	// definitions.index
+	lua_createtable (lua, 0, 4);
+	exportPositionsMap (lua, "byFile", index.files ());
+	exportPositionsMap (lua, "byAnnotation", index.annotations ());
+	exportPositionsMap (lua, "byBase", index.bases ());
+	exportPositionsMap (lua, "derivedFrom", index.derived ());
+	lua_setfield (lua, -3, "index");
 	
 	// 
-	lua_setfield (lua, -2, name);
+	lua_pop(lua, 1);
 }
 
-void LuaGenerator::pushVariable (lua_State *lua, const VariableDef &variable) {
-	lua_createtable (lua, 0, 13);
+void LuaGenerator::exportPositionsMap (lua_State *lua, const char *name,
+                                       const QHash< Symbol, DefinitionIndex::Positions > &map) {
+	lua_createtable (lua, 0, map.size ());
 	
-	// 
-	lua_pushstring (lua, variable.name.toLatin1 ().constData ());
-	lua_setfield (lua, -2, "name");
-	
-	pushAccessSpecifier (lua, variable.access);
-	lua_setfield (lua, -2, "access");
-	
-	insertSourceRange (lua, "loc", variable.loc);
-	insertString (lua, "type", variable.type);
-	insertString (lua, "getter", variable.getter);
-	insertString (lua, "setterArgName", variable.setterArgName);
-	insertString (lua, "setter", variable.setter);
-	exportAnnotations (lua, variable.annotations);
-	insertBool (lua, "isConst", variable.isConst);
-	insertBool (lua, "isReference", variable.isReference);
-	insertBool (lua, "isPodType", variable.isPodType);
-	insertBool (lua, "isOptional", variable.isOptional);
-	insertBool (lua, "setterReturnsBool", variable.setterReturnsBool);
-	
-}
-
-void LuaGenerator::exportMethods (lua_State *lua, const Methods &methods) {
-	lua_createtable (lua, methods.length (), 0);
-	for (int i = 0; i < methods.length (); i++) {
-		const MethodDef &m = methods.at (i);
-		lua_createtable (lua, 0, 11);
-		
-		// 
-		pushAccessSpecifier (lua, m.access);
-		lua_setfield (lua, -2, "access");
-		
-		pushMethodType (lua, m.type);
-		lua_setfield (lua, -2, "type");
-		
-		pushVariable (lua, m.returnType);
-		lua_setfield (lua, -2, "returnType");
+	// Stack: Classes by position, index, map
+	for (auto it = map.constBegin (), end = map.constEnd (); it != end; ++it) {
+		pushSymbol (lua, it.key ());
+		lua_createtable (lua, it->length (), 0);
 		
-		insertBool (lua, "isVirtual", m.isVirtual);
-		insertBool (lua, "isPure", m.isPure);
-		insertBool (lua, "isConst", m.isConst);
-		insertString (lua, "name", m.name);
-		exportVariables (lua, "arguments", m.arguments);
-		exportAnnotations (lua, m.annotations);
-		insertBool (lua, "hasOptionalArguments", m.hasOptionalArguments);
-		insertSourceRange (lua, "loc", m.loc);
+		for (int i = 0; i < it->length (); i++) {
+			lua_rawgeti (lua, -5, it->at (i) + 1);
+			lua_rawseti (lua, -2, i + 1);
+		}
 		
-		// 
-		lua_rawseti (lua, -2, i + 1);
+		lua_rawset (lua, -3);
 	}
 	
 	// 
-	lua_setfield (lua, -2, "methods");
+	lua_setfield (lua, -2, name);
 }
 
-void LuaGenerator::exportEnums (lua_State *lua, const Enums &enums) {
-	lua_createtable (lua, 0, enums.length ());
-	for (int i = 0; i < enums.length (); i++) {
-		const EnumDef &e = enums.at (i);
-		lua_pushstring (lua, e.name.toLatin1 ().constData ());
-		lua_createtable (lua, 0, 4);
-		
-		// 
-		lua_pushvalue (lua, -2);
-		lua_setfield (lua, -2, "name");
-		
-		exportAnnotations (lua, e.annotations);
-		exportEnumValues (lua, e.elements);
-		insertSourceRange (lua, "loc", e.loc);
-		
-		// 
-		lua_settable (lua, -3);
-	}
-	
-	// 
-	lua_setfield (lua, -2, "enums");
+static int dumpToByteArray (lua_State *, const void *data, size_t length, void *userData) {
+	static_cast< QByteArray * > (userData)->append (static_cast< const char * > (data), length);
+	return 0;
 }
 
-void LuaGenerator::exportEnumValues (lua_State *lua, const QMap< QString, int > &elements) {
-	lua_createtable (lua, 0, elements.size ());
-	
-	if (elements.size () > 0) { // Reverse iterate to keep sort order
-		auto it = elements.end (), end = elements.begin ();
-		do {
-			--it;
-			lua_pushstring (lua, it.key ().toUtf8 ().constData ());
-			lua_pushinteger (lua, it.value ());
-			lua_settable (lua, -3);
-		} while (it != end);
-		
-	}
+void LuaGenerator::precompileBuiltinScripts () {
+	std::unique_ptr< lua_State, decltype(&lua_close) > lua (lua_open (), &lua_close);
 	
-	// 
-	lua_setfield (lua, -2, "elements");
-}
-
-void LuaGenerator::exportConversions (lua_State *lua, const Conversions &conversions) {
-	lua_createtable (lua, conversions.length (), 0);
-	for (int i = 0; i < conversions.length (); i++) {
-		const ConversionDef &conv = conversions.at (i);
-		lua_createtable (lua, 0, 6);
-		
-		// 
-		pushMethodType (lua, conv.type);
-		lua_setfield (lua, -2, "type");
+	QDirIterator it (QStringLiteral(":/lua/"), QDir::Files);
+	while (it.hasNext ()) {
+		QString path = it.next ();
+		QFile file (path);
+		if (!file.open (QIODevice::ReadOnly)) {
+			continue;
+		}
 		
-		insertString (lua, "methodName", conv.methodName);
-		insertString (lua, "fromType", conv.fromType);
-		insertString (lua, "toType", conv.toType);
-		insertBool (lua, "isConst", conv.isConst);
-		insertSourceRange (lua, "loc", conv.loc);
+		// Compile and dump the byte-code
+		QByteArray byteCode;
+		if (loadFromByteArray (lua.get (), file.readAll (), path) &&
+		    lua_dump (lua.get (), &dumpToByteArray, &byteCode) == 0) {
+			precompiledScripts.insert (path, byteCode);
+		}
 		
-		// 
-		lua_rawseti (lua, -2, i + 1);
+		lua_settop (lua.get (), 0);
 	}
 	
-	// 
-	lua_setfield (lua, -2, "conversions");
 }
 
 static int loadModule (lua_State *lua, const QString &path, const QString &name) {
+	QByteArray code = precompiledScripts.value (path);
+	
+	// Load from disk if it hasn't been compiled yet
 	QFile file (path);
-	if (!file.open (QIODevice::ReadOnly)) {
+	if (code.isEmpty () && !file.open (QIODevice::ReadOnly)) {
 		return 0;
+	} else if (code.isEmpty ()) {
+		code = file.readAll ();
 	}
 	
 	// 
-	QByteArray code = file.readAll ();
 	if (!loadFromByteArray (lua, code, name)) {
 		reportExecuteError (lua, name);
 		return 0;
@@ -862,6 +979,33 @@ static QVariant luaTableToVariant (lua_State *lua) {
 	return luaMapToVariant (lua);
 }
 
+// Proxies of the definitions are arrays or maps, like the tables they replace
+static QVariant luaProxyToVariant (lua_State *lua) {
+	int arrLen = LuaProxy::arrayLength (lua, -1);
+	int index = lua_gettop (lua);
+	QVariantList list;
+	QVariantMap map;
+	
+	lua_pushnil (lua);
+	while (LuaProxy::next (lua, index)) {
+		if (arrLen > 0) {
+			list.append (luaToVariant (lua));
+		} else {
+			size_t len = 0;
+			const char *rawKey = lua_tolstring (lua, -2, &len);
+			map.insert (QString::fromUtf8 (rawKey, len), luaToVariant (lua));
+		}
+		
+		lua_pop(lua, 1);
+	}
+	
+	if (arrLen > 0) {
+		return list;
+	}
+	
+	return map;
+}
+
 static QVariant luaToVariant (lua_State *lua) {
 	switch (lua_type (lua, -1)) {
 	case LUA_TSTRING:
@@ -872,13 +1016,19 @@ static QVariant luaToVariant (lua_State *lua) {
 		return lua_tonumber (lua, -1);
 	case LUA_TTABLE:
 		return luaTableToVariant (lua);
+	case LUA_TUSERDATA:
+		if (LuaProxy::isProxy (lua, -1)) {
+			return luaProxyToVariant (lua);
+		}
+		
+		break;
 	}
 	
 	return QVariant ();
 }
 
 int LuaGenerator::jsonSerialize (lua_State *lua) {
-	if (lua_gettop (lua) != 1 || !lua_istable(lua, 1)) {
+	if (lua_gettop (lua) != 1 || (!lua_istable(lua, 1) && !LuaProxy::isProxy (lua, 1))) {
 		return luaL_error (lua, "json.serialize expects a table as only argument.");
 	}
 	
@@ -893,17 +1043,12 @@ int LuaGenerator::jsonSerialize (lua_State *lua) {
 
 int LuaGenerator::sourceRangeToString (lua_State *lua) {
 	Compiler *comp = (Compiler *)lua_touserdata (lua, lua_upvalueindex(1));
-	void *ptr = luaL_checkudata (lua, 1, METATABLE_SOURCERANGE);
-	clang::SourceRange *range = static_cast< clang::SourceRange * > (ptr);
-	
-	if (!range) {
-		return 0;
-	}
+	clang::SourceRange range = getSourceRange (lua, 1);
 	
 	// Create string
 	clang::SourceManager &sm = comp->compiler ()->getSourceManager ();
-	std::string begin = range->getBegin ().printToString (sm);
-	std::string end = range->getEnd ().printToString (sm);
+	std::string begin = range.getBegin ().printToString (sm);
+	std::string end = range.getEnd ().printToString (sm);
 	lua_pushliteral(lua, "[");
 	lua_pushlstring (lua, begin.c_str (), begin.length ());
 	lua_pushliteral(lua, "]:[");
@@ -21,7 +21,7 @@
 
 struct lua_State;
 class Compiler;
-class QFile;
+class QIODevice;
 
 struct GenConf {
 	QString luaScript;
@@ -32,40 +32,70 @@ struct GenConf {
 class LuaGenerator {
 public:
 	LuaGenerator (Definitions *definitions, Compiler *compiler);
+	~LuaGenerator ();
 	
 	static bool parseConfig (const std::string &string, GenConf &config);
 	bool generate (const GenConf &config);
 	
+	/**
+	 * Runs the generator described by \a config, but writes into \a output
+	 * instead of the out-file. Use writeOutput() to write it later on.
+	 */
+	bool generate (const GenConf &config, QByteArray &output);
+	
+	/** Writes \a data to \a outFile, which may be "-" or "+path". */
+	static bool writeOutput (const QString &outFile, const QByteArray &data);
+	
+	/**
+	 * Like writeOutput(), but only replaces \a outFile if its content
+	 * differs from \a data, keeping its modification time otherwise. The
+	 * file is replaced atomically. \a changed is set to \c false if the
+	 * file was kept. Outputs to stdout or appending ones are always
+	 * written.
+	 */
+	static bool updateOutput (const QString &outFile, const QByteArray &data, bool &changed);
+	
+	/**
+	 * Returns \c true if all \a generators are built-in ones. These only
+	 * use the introspected types of the input.
+	 */
+	static bool allBuiltin (const QVector< GenConf > &generators);
+	
+	/** Removes the output of a failed run. */
+	static void removeOutput (const QString &outFile);
+	
+	/**
+	 * Compiles all built-in Lua scripts to byte-code, which is then used
+	 * by all following runs. Only worth it for long-running processes.
+	 */
+	static void precompileBuiltinScripts ();
+	
 private:
 	
 	bool loadScript (const QString &path, QByteArray &code);
-	bool runScript (const GenConf &config, const QByteArray &script, QFile *outFile);
+	bool runScript (const GenConf &config, const QByteArray &script, QIODevice *outFile);
 	void startShell (lua_State *lua);
 	
-	void initState (lua_State *lua, const GenConf &config, QFile *file);
+	lua_State *sharedState ();
+	void initState (lua_State *lua);
+	void createEnvironment (lua_State *lua, const GenConf &config);
 	void addInformation (lua_State *lua, const GenConf &config);
 	void addLog (lua_State *lua);
 	void addJson (lua_State *lua);
-	void addWrite (lua_State *lua, QFile *file);
+	void addWrite (lua_State *lua);
 	void addLibLoader (lua_State *lua);
 	void registerSourceRangeMetatable (lua_State *lua);
 	
 	void exportDefinitions (lua_State *lua);
 	void exportStringSet (lua_State *lua, const char *name, const StringSet &set);
+	void exportStringLookup (lua_State *lua, const char *name, const StringSet &set);
 	void exportStringMap (lua_State *lua, const char *name, const StringMap &map);
 	void exportStringList (lua_State *lua, const char *name, const QStringList &list);
 	void exportStringBoolMap (lua_State *lua, const char *name, const QMap< QString, bool > &map);
 	void exportClassDefinitions (lua_State *lua);
-	void exportClassDefinition (lua_State *lua, const ClassDef &def);
-	void exportClassDefinitionBase (lua_State *lua, const ClassDef &def);
-	void exportBases (lua_State *lua, const Bases &bases);
-	void exportAnnotations (lua_State *lua, const Annotations &annotations);
-	void exportVariables (lua_State *lua, const char *name, const Variables &variables);
-	void pushVariable (lua_State *lua, const VariableDef &variable);
-	void exportMethods (lua_State *lua, const Methods &methods);
-	void exportEnums (lua_State *lua, const Enums &enums);
-	void exportEnumValues (lua_State *lua, const QMap< QString, int > &elements);
-	void exportConversions (lua_State *lua, const Conversions &conversions);
+	void exportIndex (lua_State *lua);
+	void exportPositionsMap (lua_State *lua, const char *name,
+	                         const QHash< Symbol, DefinitionIndex::Positions > &map);
 	
 	static int requireLoader (lua_State *lua);
 	
@@ -76,6 +106,10 @@ private:
 	Definitions *m_definitions;
 	Compiler *m_compiler;
 	
+	// Shared by all generators run by this instance
+	lua_State *m_lua = nullptr;
+	int m_sharedDefinitions = 0;
+	
 };
 
 #endif // LUAGENERATOR_HPP
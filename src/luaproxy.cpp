@@ -0,0 +1,768 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "luaproxy.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <lua.hpp>
+#include <new>
+
+#define METATABLE_PROXY "tria.Proxy"
+#define REGISTRY_PROXIES "tria.proxies"
+
+namespace {
+
+enum ProxyKind {
+	ClassKind = 0,
+	BaseKind,
+	VariableKind,
+	MethodKind,
+	EnumKind,
+	ConversionKind,
+	AnnotationKind,
+	
+	// Arrays
+	VariablesKind,
+	MethodsKind,
+	ConversionsKind,
+	AnnotationsKind,
+	
+	// Keyed by name
+	BasesKind,
+	EnumsKind,
+	ElementsKind,
+	
+	KindCount
+};
+
+struct Proxy {
+	ProxyKind kind;
+	const void *data;
+};
+
+typedef void (*FieldGetter) (lua_State *lua, const void *data);
+
+struct Field {
+	const char *name;
+	FieldGetter get;
+};
+
+}
+
+template< typename T >
+static inline const T &as (const void *data) {
+	return *static_cast< const T * > (data);
+}
+
+static Proxy *toProxy (lua_State *lua, int index) {
+	Proxy *proxy = static_cast< Proxy * > (lua_touserdata (lua, index));
+	if (!proxy || !lua_getmetatable (lua, index)) {
+		return nullptr;
+	}
+	
+	luaL_getmetatable(lua, METATABLE_PROXY);
+	bool isProxy = lua_rawequal (lua, -1, -2);
+	lua_pop(lua, 2);
+	return (isProxy) ? proxy : nullptr;
+}
+
+static void pushProxy (lua_State *lua, ProxyKind kind, const void *data) {
+	lua_getfield (lua, LUA_REGISTRYINDEX, REGISTRY_PROXIES);
+	lua_rawgeti (lua, -1, kind + 1);
+	
+	// Reuse the proxy of data if it's still alive
+	lua_pushlightuserdata (lua, const_cast< void * > (data));
+	lua_rawget (lua, -2);
+	if (!lua_isnil(lua, -1)) {
+		lua_replace (lua, -3);
+		lua_pop(lua, 1);
+		return;
+	}
+	
+	lua_pop(lua, 1);
+	
+	// 
+	Proxy *proxy = static_cast< Proxy * > (lua_newuserdata (lua, sizeof(Proxy)));
+	proxy->kind = kind;
+	proxy->data = data;
+	luaL_getmetatable(lua, METATABLE_PROXY);
+	lua_setmetatable (lua, -2);
+	
+	lua_pushlightuserdata (lua, const_cast< void * > (data));
+	lua_pushvalue (lua, -2);
+	lua_rawset (lua, -4);
+	
+	// 
+	lua_replace (lua, -3);
+	lua_pop(lua, 1);
+}
+
+static inline void pushSymbol (lua_State *lua, const Symbol &symbol) {
+	lua_pushlstring (lua, symbol.data (), symbol.length ());
+}
+
+static inline void pushString (lua_State *lua, const QString &string) {
+	QByteArray utf8 = string.toUtf8 ();
+	lua_pushlstring (lua, utf8.constData (), utf8.length ());
+}
+
+static void pushAccessSpecifier (lua_State *lua, clang::AccessSpecifier spec) {
+	switch (spec) {
+	case clang::AS_public:
+		lua_pushliteral(lua, "public");
+		break;
+	case clang::AS_protected:
+		lua_pushliteral(lua, "protected");
+		break;
+	case clang::AS_private:
+		lua_pushliteral(lua, "private");
+		break;
+	case clang::AS_none:
+		lua_pushliteral(lua, "none");
+		break;
+	default:
+		lua_pushnil (lua);
+	}
+	
+}
+
+static void pushAnnotationType (lua_State *lua, AnnotationType type) {
+	switch (type) {
+	case IntrospectAnnotation:
+		lua_pushliteral(lua, "introspect");
+		break;
+	case SkipAnnotation:
+		lua_pushliteral(lua, "skip");
+		break;
+	case ReadAnnotation:
+		lua_pushliteral(lua, "read");
+		break;
+	case WriteAnnotation:
+		lua_pushliteral(lua, "write");
+		break;
+	case RequireAnnotation:
+		lua_pushliteral(lua, "require");
+		break;
+	case CustomAnnotation:
+		lua_pushliteral(lua, "custom");
+		break;
+	default:
+		lua_pushnil (lua);
+	}
+	
+}
+
+static void pushMethodType (lua_State *lua, MethodType type) {
+	switch (type) {
+	case ConstructorMethod:
+		lua_pushliteral(lua, "constructor");
+		break;
+	case DestructorMethod:
+		lua_pushliteral(lua, "destructor");
+		break;
+	case MemberMethod:
+		lua_pushliteral(lua, "member");
+		break;
+	case StaticMethod:
+		lua_pushliteral(lua, "static");
+		break;
+	default:
+		lua_pushnil (lua);
+	}
+	
+}
+
+// Fields of each kind of object, in the order pairs() returns them.
+static const Field classFields[] = {
+	{ "name", [](lua_State *lua, const void *d) { pushSymbol (lua, as< ClassDef > (d).name); } },
+	{ "file", [](lua_State *lua, const void *d) { pushSymbol (lua, as< ClassDef > (d).file); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< ClassDef > (d).loc); } },
+	{ "hasValueSemantics", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).hasValueSemantics); } },
+	{ "hasDefaultCtor", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).hasDefaultCtor); } },
+	{ "hasCopyCtor", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).hasCopyCtor); } },
+	{ "hasAssignmentOperator", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).hasAssignmentOperator); } },
+	{ "implementsCtor", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).implementsCtor); } },
+	{ "implementsCopyCtor", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).implementsCopyCtor); } },
+	{ "isFakeClass", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).isFakeClass); } },
+	{ "hasPureVirtuals", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ClassDef > (d).hasPureVirtuals); } },
+	{ "bases", [](lua_State *lua, const void *d) { pushProxy (lua, BasesKind, &as< ClassDef > (d).bases); } },
+	{ "variables", [](lua_State *lua, const void *d) { pushProxy (lua, VariablesKind, &as< ClassDef > (d).variables); } },
+	{ "methods", [](lua_State *lua, const void *d) { pushProxy (lua, MethodsKind, &as< ClassDef > (d).methods); } },
+	{ "enums", [](lua_State *lua, const void *d) { pushProxy (lua, EnumsKind, &as< ClassDef > (d).enums); } },
+	{ "annotations", [](lua_State *lua, const void *d) { pushProxy (lua, AnnotationsKind, &as< ClassDef > (d).annotations); } },
+	{ "conversions", [](lua_State *lua, const void *d) { pushProxy (lua, ConversionsKind, &as< ClassDef > (d).conversions); } },
+	{ nullptr, nullptr }
+};
+
+static const Field baseFields[] = {
+	{ "isVirtual", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< BaseDef > (d).isVirtual); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< BaseDef > (d).loc); } },
+	{ "access", [](lua_State *lua, const void *d) { pushAccessSpecifier (lua, as< BaseDef > (d).access); } },
+	{ nullptr, nullptr }
+};
+
+static const Field variableFields[] = {
+	{ "name", [](lua_State *lua, const void *d) { pushSymbol (lua, as< VariableDef > (d).name); } },
+	{ "access", [](lua_State *lua, const void *d) { pushAccessSpecifier (lua, as< VariableDef > (d).access); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< VariableDef > (d).loc); } },
+	{ "type", [](lua_State *lua, const void *d) { pushSymbol (lua, as< VariableDef > (d).type); } },
+	{ "getter", [](lua_State *lua, const void *d) { pushSymbol (lua, as< VariableDef > (d).getter); } },
+	{ "setterArgName", [](lua_State *lua, const void *d) { pushSymbol (lua, as< VariableDef > (d).setterArgName); } },
+	{ "setter", [](lua_State *lua, const void *d) { pushSymbol (lua, as< VariableDef > (d).setter); } },
+	{ "annotations", [](lua_State *lua, const void *d) { pushProxy (lua, AnnotationsKind, &as< VariableDef > (d).annotations); } },
+	{ "isConst", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< VariableDef > (d).isConst); } },
+	{ "isReference", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< VariableDef > (d).isReference); } },
+	{ "isPodType", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< VariableDef > (d).isPodType); } },
+	{ "isOptional", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< VariableDef > (d).isOptional); } },
+	{ "setterReturnsBool", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< VariableDef > (d).setterReturnsBool); } },
+	{ nullptr, nullptr }
+};
+
+static const Field methodFields[] = {
+	{ "name", [](lua_State *lua, const void *d) { pushSymbol (lua, as< MethodDef > (d).name); } },
+	{ "access", [](lua_State *lua, const void *d) { pushAccessSpecifier (lua, as< MethodDef > (d).access); } },
+	{ "type", [](lua_State *lua, const void *d) { pushMethodType (lua, as< MethodDef > (d).type); } },
+	{ "returnType", [](lua_State *lua, const void *d) { pushProxy (lua, VariableKind, &as< MethodDef > (d).returnType); } },
+	{ "isVirtual", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< MethodDef > (d).isVirtual); } },
+	{ "isPure", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< MethodDef > (d).isPure); } },
+	{ "isConst", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< MethodDef > (d).isConst); } },
+	{ "arguments", [](lua_State *lua, const void *d) { pushProxy (lua, VariablesKind, &as< MethodDef > (d).arguments); } },
+	{ "annotations", [](lua_State *lua, const void *d) { pushProxy (lua, AnnotationsKind, &as< MethodDef > (d).annotations); } },
+	{ "hasOptionalArguments", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< MethodDef > (d).hasOptionalArguments); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< MethodDef > (d).loc); } },
+	{ nullptr, nullptr }
+};
+
+static const Field enumFields[] = {
+	{ "name", [](lua_State *lua, const void *d) { pushSymbol (lua, as< EnumDef > (d).name); } },
+	{ "annotations", [](lua_State *lua, const void *d) { pushProxy (lua, AnnotationsKind, &as< EnumDef > (d).annotations); } },
+	{ "elements", [](lua_State *lua, const void *d) { pushProxy (lua, ElementsKind, &as< EnumDef > (d).elements); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< EnumDef > (d).loc); } },
+	{ nullptr, nullptr }
+};
+
+static const Field conversionFields[] = {
+	{ "type", [](lua_State *lua, const void *d) { pushMethodType (lua, as< ConversionDef > (d).type); } },
+	{ "methodName", [](lua_State *lua, const void *d) { pushSymbol (lua, as< ConversionDef > (d).methodName); } },
+	{ "fromType", [](lua_State *lua, const void *d) { pushSymbol (lua, as< ConversionDef > (d).fromType); } },
+	{ "toType", [](lua_State *lua, const void *d) { pushSymbol (lua, as< ConversionDef > (d).toType); } },
+	{ "isConst", [](lua_State *lua, const void *d) { lua_pushboolean (lua, as< ConversionDef > (d).isConst); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< ConversionDef > (d).loc); } },
+	{ nullptr, nullptr }
+};
+
+static void pushAnnotationTypeName (lua_State *lua, const void *d) {
+	const char *typeName = QMetaType::typeName (as< AnnotationDef > (d).valueType);
+	lua_pushstring (lua, typeName ? typeName : "");
+}
+
+static const Field annotationFields[] = {
+	{ "name", [](lua_State *lua, const void *d) { pushSymbol (lua, as< AnnotationDef > (d).name); } },
+	{ "value", [](lua_State *lua, const void *d) { pushString (lua, as< AnnotationDef > (d).value); } },
+	{ "loc", [](lua_State *lua, const void *d) { LuaProxy::pushSourceRange (lua, as< AnnotationDef > (d).loc); } },
+	{ "type", [](lua_State *lua, const void *d) { pushAnnotationType (lua, as< AnnotationDef > (d).type); } },
+	{ "valueType", [](lua_State *lua, const void *d) { lua_pushinteger (lua, as< AnnotationDef > (d).valueType); } },
+	{ "typeName", &pushAnnotationTypeName },
+	{ nullptr, nullptr }
+};
+
+// Indexed by ProxyKind, nullptr for lists
+static const Field *const objectFields[KindCount] = {
+	classFields, baseFields, variableFields, methodFields, enumFields, conversionFields, annotationFields
+};
+
+static int findField (const Field *fields, lua_State *lua, int key) {
+	if (lua_type (lua, key) != LUA_TSTRING) {
+		return -1;
+	}
+	
+	const char *name = lua_tostring(lua, key);
+	for (int i = 0; fields[i].name; i++) {
+		if (!strcmp (fields[i].name, name)) {
+			return i;
+		}
+		
+	}
+	
+	return -1;
+}
+
+// Arrays
+static int proxyLength (const Proxy &proxy) {
+	switch (proxy.kind) {
+	case VariablesKind:
+		return as< Variables > (proxy.data).length ();
+	case MethodsKind:
+		return as< Methods > (proxy.data).length ();
+	case ConversionsKind:
+		return as< Conversions > (proxy.data).length ();
+	case AnnotationsKind:
+		return as< Annotations > (proxy.data).length ();
+	default:
+		return -1;
+	}
+	
+}
+
+static void pushElement (lua_State *lua, const Proxy &proxy, int i) {
+	switch (proxy.kind) {
+	case VariablesKind:
+		pushProxy (lua, VariableKind, &as< Variables > (proxy.data).at (i));
+		break;
+	case MethodsKind:
+		pushProxy (lua, MethodKind, &as< Methods > (proxy.data).at (i));
+		break;
+	case ConversionsKind:
+		pushProxy (lua, ConversionKind, &as< Conversions > (proxy.data).at (i));
+		break;
+	case AnnotationsKind:
+		pushProxy (lua, AnnotationKind, &as< Annotations > (proxy.data).at (i));
+		break;
+	default:
+		lua_pushnil (lua);
+	}
+	
+}
+
+// Bases and enums, keyed by their name
+static int namedLength (const Proxy &proxy) {
+	if (proxy.kind == BasesKind) {
+		return as< Bases > (proxy.data).length ();
+	}
+	
+	return as< Enums > (proxy.data).length ();
+}
+
+static Symbol nameAt (const Proxy &proxy, int i) {
+	if (proxy.kind == BasesKind) {
+		return as< Bases > (proxy.data).at (i).name;
+	}
+	
+	return as< Enums > (proxy.data).at (i).name;
+}
+
+static void pushNamed (lua_State *lua, const Proxy &proxy, int i) {
+	if (proxy.kind == BasesKind) {
+		pushProxy (lua, BaseKind, &as< Bases > (proxy.data).at (i));
+	} else {
+		pushProxy (lua, EnumKind, &as< Enums > (proxy.data).at (i));
+	}
+	
+}
+
+static int findNamed (lua_State *lua, const Proxy &proxy, int key) {
+	if (lua_type (lua, key) != LUA_TSTRING) {
+		return -1;
+	}
+	
+	// Compare the bytes, so unknown keys aren't interned
+	size_t length = 0;
+	const char *name = lua_tolstring (lua, key, &length);
+	for (int i = 0, count = namedLength (proxy); i < count; i++) {
+		Symbol cur = nameAt (proxy, i);
+		if (size_t (cur.length ()) == length && !memcmp (cur.data (), name, length)) {
+			return i;
+		}
+		
+	}
+	
+	return -1;
+}
+
+static QString elementName (lua_State *lua, int key) {
+	size_t length = 0;
+	const char *name = lua_tolstring (lua, key, &length);
+	return (name) ? QString::fromUtf8 (name, length) : QString ();
+}
+
+static void pushField (lua_State *lua, const Proxy &proxy, int key) {
+	const Field *fields = objectFields[proxy.kind];
+	if (fields) {
+		int i = findField (fields, lua, key);
+		if (i < 0) {
+			lua_pushnil (lua);
+		} else {
+			fields[i].get (lua, proxy.data);
+		}
+		
+		return;
+	}
+	
+	// 
+	int length = proxyLength (proxy);
+	if (length >= 0) {
+		int i = (lua_type (lua, key) == LUA_TNUMBER) ? int (lua_tointeger (lua, key)) : 0;
+		if (i < 1 || i > length) {
+			lua_pushnil (lua);
+		} else {
+			pushElement (lua, proxy, i - 1);
+		}
+		
+		return;
+	}
+	
+	// 
+	if (proxy.kind == ElementsKind) {
+		const QMap< QString, int > &elements = as< QMap< QString, int > > (proxy.data);
+		auto it = elements.constFind (elementName (lua, key));
+		if (lua_type (lua, key) != LUA_TSTRING || it == elements.constEnd ()) {
+			lua_pushnil (lua);
+		} else {
+			lua_pushinteger (lua, it.value ());
+		}
+		
+		return;
+	}
+	
+	int i = findNamed (lua, proxy, key);
+	if (i < 0) {
+		lua_pushnil (lua);
+	} else {
+		pushNamed (lua, proxy, i);
+	}
+	
+}
+
+static int proxyIndex (lua_State *lua) {
+	Proxy *proxy = toProxy (lua, 1);
+	luaL_argcheck(lua, proxy != nullptr, 1, METATABLE_PROXY " expected");
+	
+	pushField (lua, *proxy, 2);
+	return 1;
+}
+
+static int proxyNewIndex (lua_State *lua) {
+	return luaL_error (lua, "Definitions are read-only");
+}
+
+static const char *const kindNames[KindCount] = {
+	"class", "base", "variable", "method", "enum", "conversion", "annotation",
+	"variables", "methods", "conversions", "annotations", "bases", "enums", "elements"
+};
+
+static Symbol proxyName (const Proxy &proxy) {
+	switch (proxy.kind) {
+	case ClassKind:
+		return as< ClassDef > (proxy.data).name;
+	case BaseKind:
+		return as< BaseDef > (proxy.data).name;
+	case VariableKind:
+		return as< VariableDef > (proxy.data).name;
+	case MethodKind:
+		return as< MethodDef > (proxy.data).name;
+	case EnumKind:
+		return as< EnumDef > (proxy.data).name;
+	case ConversionKind:
+		return as< ConversionDef > (proxy.data).toType;
+	case AnnotationKind:
+		return as< AnnotationDef > (proxy.data).name;
+	default:
+		return Symbol ();
+	}
+	
+}
+
+// "class Foo" for objects, "methods (3)" for lists
+static int proxyToString (lua_State *lua) {
+	Proxy *proxy = toProxy (lua, 1);
+	luaL_argcheck(lua, proxy != nullptr, 1, METATABLE_PROXY " expected");
+	
+	if (objectFields[proxy->kind]) {
+		lua_pushstring (lua, kindNames[proxy->kind]);
+		lua_pushliteral(lua, " ");
+		pushSymbol (lua, proxyName (*proxy));
+		lua_concat (lua, 3);
+	} else {
+		int length = proxyLength (*proxy);
+		if (length < 0) {
+			length = (proxy->kind == ElementsKind)
+			        ? as< QMap< QString, int > > (proxy->data).size ()
+			        : namedLength (*proxy);
+		}
+		
+		lua_pushfstring (lua, "%s (%d)", kindNames[proxy->kind], length);
+	}
+	
+	return 1;
+}
+
+static int toTable (lua_State *lua) {
+	luaL_checkany (lua, 1);
+	lua_settop (lua, 1);
+	LuaProxy::pushTable (lua, 1);
+	return 1;
+}
+
+static int proxyLen (lua_State *lua) {
+	Proxy *proxy = toProxy (lua, 1);
+	lua_pushinteger (lua, (proxy) ? std::max (proxyLength (*proxy), 0) : 0);
+	return 1;
+}
+
+static int proxyNext (lua_State *lua) {
+	lua_settop (lua, 2);
+	if (LuaProxy::next (lua, 1)) {
+		return 2;
+	}
+	
+	lua_pushnil (lua);
+	return 1;
+}
+
+static int proxyPairs (lua_State *lua) {
+	lua_pushcfunction(lua, &proxyNext);
+	lua_pushvalue (lua, 1);
+	lua_pushnil (lua);
+	return 3;
+}
+
+static int proxyNextIndex (lua_State *lua) {
+	Proxy *proxy = toProxy (lua, 1);
+	int i = int (luaL_checkinteger (lua, 2));
+	
+	// Only arrays have indices
+	if (!proxy || i < 0 || i >= proxyLength (*proxy)) {
+		return 0;
+	}
+	
+	lua_pushinteger (lua, i + 1);
+	pushElement (lua, *proxy, i);
+	return 2;
+}
+
+static int proxyIpairs (lua_State *lua) {
+	lua_pushcfunction(lua, &proxyNextIndex);
+	lua_pushvalue (lua, 1);
+	lua_pushinteger (lua, 0);
+	return 3;
+}
+
+// pairs() and ipairs() of Lua 5.1 only work on tables. This version tries
+// the metamethod first, like Lua 5.2 does.
+static int iterateWithMetamethod (lua_State *lua) {
+	if (luaL_getmetafield (lua, 1, lua_tostring(lua, lua_upvalueindex(2)))) {
+		lua_pushvalue (lua, 1);
+		lua_call (lua, 1, 3);
+		return 3;
+	}
+	
+	// Call the original function
+	lua_pushvalue (lua, lua_upvalueindex(1));
+	lua_insert (lua, 1);
+	lua_call (lua, lua_gettop (lua) - 1, 3);
+	return 3;
+}
+
+static void wrapIterator (lua_State *lua, const char *name, const char *metamethod) {
+	lua_getfield (lua, LUA_GLOBALSINDEX, name);
+	lua_pushstring (lua, metamethod);
+	lua_pushcclosure (lua, &iterateWithMetamethod, 2);
+	lua_setfield (lua, LUA_GLOBALSINDEX, name);
+}
+
+void LuaProxy::registerMetatable (lua_State *lua) {
+	luaL_newmetatable (lua, METATABLE_PROXY);
+	
+	lua_pushcfunction(lua, &proxyIndex);
+	lua_setfield (lua, -2, "__index");
+	
+	lua_pushcfunction(lua, &proxyNewIndex);
+	lua_setfield (lua, -2, "__newindex");
+	
+	lua_pushcfunction(lua, &proxyLen);
+	lua_setfield (lua, -2, "__len");
+	
+	lua_pushcfunction(lua, &proxyPairs);
+	lua_setfield (lua, -2, "__pairs");
+	
+	lua_pushcfunction(lua, &proxyIpairs);
+	lua_setfield (lua, -2, "__ipairs");
+	
+	lua_pushcfunction(lua, &proxyToString);
+	lua_setfield (lua, -2, "__tostring");
+	
+	// Scripts can't get at the metatable
+	lua_pushboolean (lua, false);
+	lua_setfield (lua, -2, "__metatable");
+	lua_pop(lua, 1);
+	
+	// Proxies by kind and address. Values are weak, so proxies not
+	// referenced by the script anymore are collected.
+	lua_createtable (lua, KindCount, 0);
+	lua_createtable (lua, 0, 1);
+	lua_pushliteral(lua, "v");
+	lua_setfield (lua, -2, "__mode");
+	
+	for (int i = 0; i < KindCount; i++) {
+		lua_newtable (lua);
+		lua_pushvalue (lua, -2);
+		lua_setmetatable (lua, -2);
+		lua_rawseti (lua, -3, i + 1);
+	}
+	
+	lua_pop(lua, 1);
+	lua_setfield (lua, LUA_REGISTRYINDEX, REGISTRY_PROXIES);
+	
+	// 
+	wrapIterator (lua, "pairs", "__pairs");
+	wrapIterator (lua, "ipairs", "__ipairs");
+	
+	lua_pushcfunction(lua, &toTable);
+	lua_setfield (lua, LUA_GLOBALSINDEX, "toTable");
+}
+
+void LuaProxy::pushClass (lua_State *lua, const ClassDef *def) {
+	pushProxy (lua, ClassKind, def);
+}
+
+void LuaProxy::pushSourceRange (lua_State *lua, const clang::SourceRange &range) {
+	
+	// Copy range to lua
+	void *ptr = lua_newuserdata (lua, sizeof(clang::SourceRange));
+	new (ptr) clang::SourceRange (range);
+	
+	// Set metatable
+	luaL_getmetatable(lua, METATABLE_SOURCERANGE);
+	lua_setmetatable (lua, -2);
+	
+}
+
+void LuaProxy::pushTable (lua_State *lua, int index) {
+	if (index < 0) {
+		index = lua_gettop (lua) + index + 1;
+	}
+	
+	Proxy *proxy = toProxy (lua, index);
+	if (!proxy) {
+		lua_pushvalue (lua, index);
+		return;
+	}
+	
+	// Stack: Table, key, value, copy of value
+	luaL_checkstack (lua, 4, "toTable()");
+	int length = proxyLength (*proxy);
+	lua_createtable (lua, std::max (length, 0), (length < 0) ? 8 : 0);
+	int table = lua_gettop (lua);
+	
+	lua_pushnil (lua);
+	while (next (lua, index)) {
+		pushTable (lua, -1);
+		lua_pushvalue (lua, -3);
+		lua_insert (lua, -2);
+		lua_rawset (lua, table);
+		lua_pop(lua, 1);
+	}
+	
+}
+
+bool LuaProxy::isProxy (lua_State *lua, int index) {
+	return (toProxy (lua, index) != nullptr);
+}
+
+int LuaProxy::arrayLength (lua_State *lua, int index) {
+	Proxy *proxy = toProxy (lua, index);
+	return (proxy) ? proxyLength (*proxy) : -1;
+}
+
+bool LuaProxy::next (lua_State *lua, int index) {
+	if (index < 0) {
+		index = lua_gettop (lua) + index + 1;
+	}
+	
+	Proxy *proxy = toProxy (lua, index);
+	if (!proxy) {
+		lua_pop(lua, 1);
+		return false;
+	}
+	
+	// Objects
+	bool first = lua_isnil(lua, -1);
+	const Field *fields = objectFields[proxy->kind];
+	if (fields) {
+		int i = (first) ? 0 : findField (fields, lua, -1) + 1;
+		if (i == 0 && !first) {
+			luaL_error (lua, "invalid key to 'next'");
+		}
+		
+		lua_pop(lua, 1);
+		for (; fields[i].name; i++) {
+			fields[i].get (lua, proxy->data);
+			if (!lua_isnil(lua, -1)) {
+				lua_pushstring (lua, fields[i].name);
+				lua_insert (lua, -2);
+				return true;
+			}
+			
+			lua_pop(lua, 1);
+		}
+		
+		return false;
+	}
+	
+	// Arrays
+	int length = proxyLength (*proxy);
+	if (length >= 0) {
+		int i = (first) ? 0 : int (lua_tointeger (lua, -1));
+		lua_pop(lua, 1);
+		
+		if (i < 0 || i >= length) {
+			return false;
+		}
+		
+		lua_pushinteger (lua, i + 1);
+		pushElement (lua, *proxy, i);
+		return true;
+	}
+	
+	// Enum elements
+	if (proxy->kind == ElementsKind) {
+		const QMap< QString, int > &elements = as< QMap< QString, int > > (proxy->data);
+		auto it = elements.constBegin ();
+		if (!first) {
+			it = elements.constFind (elementName (lua, -1));
+			if (it == elements.constEnd ()) {
+				luaL_error (lua, "invalid key to 'next'");
+			}
+			
+			++it;
+		}
+		
+		lua_pop(lua, 1);
+		if (it == elements.constEnd ()) {
+			return false;
+		}
+		
+		pushString (lua, it.key ());
+		lua_pushinteger (lua, it.value ());
+		return true;
+	}
+	
+	// Bases and enums
+	int i = (first) ? 0 : findNamed (lua, *proxy, -1) + 1;
+	if (i == 0 && !first) {
+		luaL_error (lua, "invalid key to 'next'");
+	}
+	
+	lua_pop(lua, 1);
+	if (i >= namedLength (*proxy)) {
+		return false;
+	}
+	
+	pushSymbol (lua, nameAt (*proxy, i));
+	pushNamed (lua, *proxy, i);
+	return true;
+}
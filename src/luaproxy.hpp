@@ -0,0 +1,74 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LUAPROXY_HPP
+#define LUAPROXY_HPP
+
+#include "defs.hpp"
+
+#define METATABLE_SOURCERANGE "clang::SourceRange"
+
+struct lua_State;
+
+/**
+ * Read-only userdata proxies of the definitions for Lua generators. A proxy
+ * has the same fields as the table exported before, but reads them from the
+ * C++ structures on access. Nested proxies are created on first access
+ * only, and are then reused while they're referenced. The proxied
+ * definitions must outlive the Lua state.
+ *
+ * Proxies support indexing, #, pairs(), ipairs() and tostring(), but aren't
+ * tables: next(), rawget(), the table library and type() checks don't work
+ * on them. toTable() returns a plain copy for such uses.
+ */
+class LuaProxy {
+public:
+	
+	/**
+	 * Registers the proxy metatable in \a lua. Also replaces pairs() and
+	 * ipairs() by versions using the __pairs and __ipairs metamethods, and
+	 * adds the global toTable().
+	 */
+	static void registerMetatable (lua_State *lua);
+	
+	/** Pushes the proxy of \a def. */
+	static void pushClass (lua_State *lua, const ClassDef *def);
+	
+	/** Pushes a userdata copy of \a range. */
+	static void pushSourceRange (lua_State *lua, const clang::SourceRange &range);
+	
+	/**
+	 * Pushes a deep copy of the proxy at \a index made of plain tables.
+	 * Other values are pushed as they are. Available to scripts as
+	 * toTable().
+	 */
+	static void pushTable (lua_State *lua, int index);
+	
+	/** Returns \c true if the value at \a index is a proxy. */
+	static bool isProxy (lua_State *lua, int index);
+	
+	/** Returns the length of the proxy at \a index, or -1 if it's no array. */
+	static int arrayLength (lua_State *lua, int index);
+	
+	/**
+	 * Like lua_next() for the proxy at \a index: Pops a key and pushes the
+	 * next key and value. Returns \c false at the end.
+	 */
+	static bool next (lua_State *lua, int index);
+	
+};
+
+#endif // LUAPROXY_HPP
@@ -17,6 +17,8 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstdio>
+#include <algorithm>
+#include <memory>
 #include <vector>
 
 #include <QStringList>
@@ -24,11 +26,17 @@
 #include <QVector>
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QDateTime>
 #include <QTime>
 #include <QDir>
 
 #include <llvm/Support/CommandLine.h>
 #include <clang/Tooling/Tooling.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/ASTUnit.h>
 #include <clang/Basic/Version.h>
 
 #include "luagenerator.hpp"
@@ -36,6 +44,14 @@
 #include "filemapper.hpp"
 #include "triaaction.hpp"
 #include "compiler.hpp"
+#include "compiledb.hpp"
+#include "resultcache.hpp"
+#include "pchcache.hpp"
+#include "depfile.hpp"
+#include "filewatcher.hpp"
+#include "defsfile.hpp"
+#include "server.hpp"
+#include "batch.hpp"
 
 // Command-line arguments
 namespace {
@@ -58,6 +74,48 @@ cl::list< std::string > argSysDirs ("isystem", cl::desc ("Include path treated a
 cl::list< std::string > argIncludeDirs ("I", cl::Prefix, cl::desc ("Additional search path"), cl::value_desc ("path"));
 cl::list< std::string > argDefines ("D", cl::Prefix, cl::desc ("#define"), cl::value_desc ("name[=value]"));
 cl::list< std::string > argUndefines ("U", cl::Prefix, cl::desc ("#undef"), cl::value_desc ("name"));
+cl::opt< std::string > argServer ("server", cl::desc ("Runs as job server listening on <socket>. Clients find it "
+                                                      "through the TRIA_SERVER environment variable"),
+                                  cl::value_desc ("socket"));
+cl::opt< std::string > argBatch ("batch", cl::desc ("Runs all jobs listed in <manifest>, one per line: "
+                                                    "header;cxx-output;json-output[;lua-generator...]"),
+                                 cl::value_desc ("manifest"));
+cl::opt< unsigned > argJobs ("jobs", cl::init (1), cl::desc ("Count of worker threads used by -batch. "
+                                                             "0 uses one per CPU core"),
+                             cl::value_desc ("N"));
+cl::opt< std::string > argBuildDir ("p", cl::desc ("Build directory containing a compile_commands.json. Compiler "
+                                                   "flags of each input are taken from the file including it"),
+                                    cl::value_desc ("build-dir"));
+cl::opt< std::string > argCacheDir ("cache-dir", cl::desc ("Directory to cache precompiled headers and generated "
+                                                           "outputs in"),
+                                    cl::value_desc ("path"));
+cl::opt< unsigned > argCacheSize ("cache-size", cl::init (512), cl::desc ("Maximum size of cached outputs in MiB"),
+                                  cl::value_desc ("MiB"));
+cl::opt< bool > argDepFile ("MD", cl::ValueDisallowed, cl::desc ("Writes a Makefile dependency file, named like the "
+                                                                 "first output plus \".d\""));
+cl::opt< std::string > argDepFilePath ("MF", cl::desc ("Writes the dependency file to <file>. Implies -MD"),
+                                       cl::value_desc ("file"));
+cl::opt< std::string > argDepTarget ("MT", cl::desc ("Target of the dependency file. Defaults to the first output"),
+                                     cl::value_desc ("target"));
+cl::opt< bool > argWriteIfChanged ("write-if-changed", cl::ValueDisallowed,
+                                   cl::desc ("Only replaces outputs whose content has changed, so their "
+                                             "modification time is kept otherwise"));
+cl::opt< std::string > argFromAst ("from-ast", cl::desc ("Reads the declarations from a pre-built AST or PCH file "
+                                                         "instead of parsing. The file must have been built with "
+                                                         "-DTRIA_RUN"),
+                                    cl::value_desc ("ast file"));
+cl::opt< std::string > argEmitDefs ("emit-defs", cl::desc ("Writes the definitions to <file>, to run generators "
+                                                          "on them later using -from-defs"),
+                                   cl::value_desc ("file"));
+cl::opt< std::string > argFromDefs ("from-defs", cl::desc ("Runs the generators on the definitions in <file>, as "
+                                                           "written by -emit-defs, without parsing"),
+                                    cl::value_desc ("file"));
+cl::opt< std::string > argMerge ("merge", cl::desc ("Merges the definitions files given as inputs into <file>. "
+                                                    "Generators run on the merged definitions"),
+                                 cl::value_desc ("file"));
+cl::opt< bool > argWatch ("watch", cl::ValueDisallowed,
+                          cl::desc ("Keeps running, and re-generates the outputs whenever the input or a file "
+                                    "included by it changes"));
 
 // Aliases
 cl::alias aliasCxxOutputFile ("o", cl::Prefix, cl::desc ("Alias for -cxx-output"), cl::aliasopt (argCxxOutputFile));
@@ -79,7 +137,7 @@ static void initClangArguments (const char *progName, std::vector< std::string >
 	arguments.push_back ("c++");
 	arguments.push_back ("-fPIE");
 	arguments.push_back ("-DTRIA_RUN");
-	arguments.push_back ("-std=c++11");
+	arguments.push_back ("-std=c++11"); // Default, a -std from -p wins
 	arguments.push_back ("-fsyntax-only");
 	
 	// Inject absolute path to the clang headers on linux.
@@ -100,7 +158,8 @@ static void initClangArguments (const char *progName, std::vector< std::string >
 	
 }
 
-static void printTimes (int total, const std::vector< std::pair< std::string, int > > &times, Definitions &defs) {
+static void printTimes (int total, const std::vector< std::pair< std::string, int > > &times,
+                        const std::vector< std::pair< std::string, bool > > &outputs, TimingNode *timing) {
 	if (!argTimes) {
 		return;
 	}
@@ -119,15 +178,36 @@ static void printTimes (int total, const std::vector< std::pair< std::string, in
 	// 
 	printf ("  %3ims  100%% total\n", total);
 	
+	// Outputs with -write-if-changed
+	if (!outputs.empty ()) {
+		printf ("Outputs:\n");
+		for (const std::pair< std::string, bool > &cur : outputs) {
+			printf ("  %s %s\n", cur.second ? "updated" : "kept   ", cur.first.c_str ());
+		}
+		
+	}
+	
 	// 
-	if (defs.timing ()) {
+	if (timing) {
 		printf ("Verbose parsing times: (Files #included multiple times are not shown)\n");
-		defs.timing ()->sort ();
-		defs.timing ()->print (1);
+		timing->sort ();
+		timing->print (1);
 	}
 	
 }
 
+static void printTypeNameStats (const Definitions &definitions) {
+	int lookups = definitions.typeNameLookups ();
+	if (!argTimes || lookups < 1) {
+		return;
+	}
+	
+	int hits = definitions.typeNameHits ();
+	printf ("Type names:\n");
+	printf ("  %i lookups, %i hits (%.1f%%), %i built\n", lookups, hits,
+	        float (hits) / float (lookups) * 100.f, lookups - hits);
+}
+
 static QVector< GenConf > generatorsFromArguments () {
 	QVector< GenConf > generators;
 	bool jsonOutput = (argJsonOutputFile.getPosition () > 0);
@@ -192,35 +272,502 @@ static QStringList sourceFileList () {
 	return list;
 }
 
-int main (int argc, const char **argv) {
+static PchCache *createPchCache () {
+	if (argCacheDir.getNumOccurrences () < 1) {
+		return nullptr;
+	}
+	
+	return new PchCache (QString::fromStdString (argCacheDir) + QStringLiteral("/pch"));
+}
+
+static ResultCache *createResultCache () {
+	if (argCacheDir.getNumOccurrences () < 1) {
+		return nullptr;
+	}
+	
+	QString path = QString::fromStdString (argCacheDir) + QStringLiteral("/results");
+	return new ResultCache (path, qint64 (argCacheSize) * 1024 * 1024);
+}
+
+static void printCacheStats (ResultCache *cache) {
+	if (argTimes && cache) {
+		cache->printStats ();
+	}
+	
+}
+
+static bool writeOutput (const QString &outFile, const QByteArray &data,
+                         std::vector< std::pair< std::string, bool > > &outputs) {
+	if (!argWriteIfChanged) {
+		return LuaGenerator::writeOutput (outFile, data);
+	}
+	
+	bool changed = true;
+	if (!LuaGenerator::updateOutput (outFile, data, changed)) {
+		return false;
+	}
+	
+	outputs.emplace_back (outFile.toStdString (), changed);
+	return true;
+}
+
+static bool writeDepFile (const QStringList &dependencies, const QVector< GenConf > &generators) {
+	if (!argDepFile && argDepFilePath.getNumOccurrences () < 1) {
+		return true;
+	}
+	
+	QString target = DepFile::target (generators);
+	if (argDepTarget.getNumOccurrences () > 0) {
+		target = QString::fromStdString (argDepTarget);
+	}
+	
+	if (target.isEmpty ()) {
+		qCritical() << "No target for the dependency file, as all outputs go to stdout. Use -MT and -MF.";
+		return false;
+	}
+	
+	QString path = target + QStringLiteral(".d");
+	if (argDepFilePath.getNumOccurrences () > 0) {
+		path = QString::fromStdString (argDepFilePath);
+	}
+	
+	return DepFile::write (path, target, dependencies);
+}
+
+static int runBatch (const char *progName, FileMapper &mapper) {
+	std::vector< std::string > arguments;
+	initClangArguments (progName, arguments);
+	
+	QTime timeTotal;
+	timeTotal.start ();
+	
+	// 
+	if (argInputFiles.getNumOccurrences () > 0 || argLuaShell ||
+	    argCxxOutputFile.getPosition () > 0 || argJsonOutputFile.getPosition () > 0 ||
+	    argLuaGenerators.getNumOccurrences () > 0 || argDepFilePath.getNumOccurrences () > 0 ||
+	    argDepTarget.getNumOccurrences () > 0 || argEmitDefs.getNumOccurrences () > 0 ||
+	    argFromDefs.getNumOccurrences () > 0 || argMerge.getNumOccurrences () > 0) {
+		qCritical() << "-batch can't be combined with input files, outputs, -shell, -MF, -MT, -emit-defs, "
+		               "-from-defs or -merge";
+		return 4;
+	}
+	
+	int threads = argJobs;
+	if (threads == 0) {
+		threads = std::max (1, QThread::idealThreadCount ());
+	}
+	
+	CompileDb database;
+	if (argBuildDir.getNumOccurrences () > 0 && !database.load (argBuildDir)) {
+		return 4;
+	}
+	
+	std::unique_ptr< PchCache > pchCache (createPchCache ());
+	std::unique_ptr< ResultCache > resultCache (createResultCache ());
+	BatchRunner runner (&mapper, arguments);
+	runner.setPchCache (pchCache.get ());
+	runner.setResultCache (resultCache.get ());
+	runner.setThreadCount (threads);
+	runner.setWriteDepFiles (argDepFile);
+	runner.setWriteIfChanged (argWriteIfChanged);
+	runner.setCompileDb (argBuildDir.getNumOccurrences () > 0 ? &database : nullptr);
+	if (!runner.readManifest (QString::fromStdString (argBatch))) {
+		return 4;
+	}
+	
+	int result = runner.run ();
+	printTimes (timeTotal.elapsed (), runner.times (), runner.outputs (), nullptr);
+	printCacheStats (resultCache.get ());
+	return result;
+}
+
+static bool generateOutputs (Definitions &definitions, Compiler &compiler, const QVector< GenConf > &generators,
+                             const QTime &timeTotal, std::vector< std::pair< std::string, int > > &times,
+                             std::vector< std::pair< std::string, bool > > &written) {
+	LuaGenerator luaGenerator (&definitions, &compiler);
+	for (const GenConf &conf : generators) {
+		QByteArray data;
+		if (!argWriteIfChanged) {
+			if (!luaGenerator.generate (conf)) {
+				return false;
+			}
+			
+		} else if (!luaGenerator.generate (conf, data)) {
+			LuaGenerator::removeOutput (conf.outFile);
+			return false;
+		} else if (!writeOutput (conf.outFile, data, written)) {
+			return false;
+		}
+		
+		times.emplace_back (conf.luaScript.toStdString (), timeTotal.elapsed ());
+	}
+	
+	return true;
+}
+
+static bool emitDefinitions (const Definitions &definitions, Compiler &compiler) {
+	if (argEmitDefs.getNumOccurrences () < 1) {
+		return true;
+	}
+	
+	clang::CompilerInstance *ci = compiler.compiler ();
+	clang::SourceManager *sm = (ci->hasSourceManager ()) ? &ci->getSourceManager () : nullptr;
+	return DefsFile::write (QString::fromStdString (argEmitDefs), definitions, sm);
+}
+
+static int runFromAst () {
+	std::vector< std::pair< std::string, int > > times;
+	std::vector< std::pair< std::string, bool > > written;
+	
+	QTime timeTotal;
+	timeTotal.start ();
+	
+	// 
+	QVector< GenConf > generators = generatorsFromArguments ();
+	Compiler compiler (nullptr);
+	
+	if (!compiler.loadAst (argFromAst)) {
+		return 1;
+	}
+	
+	times.emplace_back ("load", timeTotal.elapsed ());
+	
+	// Without input files, the file the AST was built from is introspected
+	QStringList sourceFiles = sourceFileList ();
+	if (sourceFiles.isEmpty ()) {
+		QString original = QString::fromStdString (compiler.astUnit ()->getOriginalSourceFileName ());
+		if (!QFileInfo (original).isAbsolute ()) {
+			original = QDir::current ().relativeFilePath (original);
+		}
+		
+		sourceFiles.append (original);
+	}
+	
+	Definitions definitions (sourceFiles);
+	compiler.setDefinitions (&definitions);
+	if (!compiler.runAst ()) {
+		return 2;
+	}
+	
+	definitions.parsingComplete ();
+	times.emplace_back ("walk", timeTotal.elapsed ());
+	
+	if (!emitDefinitions (definitions, compiler)) {
+		return 5;
+	}
+	
+	// 
+	if (!generateOutputs (definitions, compiler, generators, timeTotal, times, written)) {
+		return 5;
+	}
+	
+	// Declarations are read from the AST on demand, so the source manager
+	// doesn't know all files the AST depends on.
+	QStringList dependencies = DepFile::dependencies (compiler, generators);
+	dependencies.prepend (QString::fromStdString (argFromAst));
+	if (!writeDepFile (dependencies, generators)) {
+		return 5;
+	}
+	
+	// 
+	printTimes (timeTotal.elapsed (), times, written, nullptr);
+	printTypeNameStats (definitions);
+	return 0;
+}
+
+static int runFromDefs () {
+	std::vector< std::pair< std::string, int > > times;
+	std::vector< std::pair< std::string, bool > > written;
+	
+	QTime timeTotal;
+	timeTotal.start ();
+	
+	// The source manager is only used to map source locations of the
+	// definitions back into the headers.
+	QVector< GenConf > generators = generatorsFromArguments ();
+	QString path = QString::fromStdString (argFromDefs);
+	Definitions definitions ((QStringList ()));
+	Compiler compiler (nullptr);
+	compiler.createSourceManager ();
+	
+	if (!DefsFile::read (path, definitions, compiler.compiler ()->getSourceManager ())) {
+		return 1;
+	}
+	
+	times.emplace_back ("load", timeTotal.elapsed ());
+	
+	// 
+	if (!generateOutputs (definitions, compiler, generators, timeTotal, times, written)) {
+		return 5;
+	}
+	
+	QStringList dependencies = DepFile::dependencies (compiler, generators);
+	dependencies.prepend (path);
+	if (!writeDepFile (dependencies, generators)) {
+		return 5;
+	}
+	
+	// 
+	printTimes (timeTotal.elapsed (), times, written, nullptr);
+	return 0;
+}
+
+static int runMerge () {
+	std::vector< std::pair< std::string, int > > times;
+	std::vector< std::pair< std::string, bool > > written;
+	
+	QTime timeTotal;
+	timeTotal.start ();
+	
+	// All files share the source manager, so source locations survive.
+	QVector< GenConf > generators = generatorsFromArguments ();
+	Definitions merged ((QStringList ()));
+	Compiler compiler (nullptr);
+	compiler.createSourceManager ();
+	clang::SourceManager &sm = compiler.compiler ()->getSourceManager ();
+	
+	for (const std::string &cur : argInputFiles) {
+		Definitions definitions ((QStringList ()));
+		if (!DefsFile::read (QString::fromStdString (cur), definitions, sm)) {
+			return 1;
+		}
+		
+		merged.merge (definitions);
+	}
+	
+	times.emplace_back ("merge", timeTotal.elapsed ());
+	
+	// 
+	if (!DefsFile::write (QString::fromStdString (argMerge), merged, &sm)) {
+		return 5;
+	}
+	
+	times.emplace_back ("index", timeTotal.elapsed ());
+	if (!generateOutputs (merged, compiler, generators, timeTotal, times, written)) {
+		return 5;
+	}
+	
+	// 
+	printTimes (timeTotal.elapsed (), times, written, nullptr);
+	return 0;
+}
+
+static int runWatch (const char *progName, FileMapper &mapper) {
+	std::vector< std::string > arguments;
+	initClangArguments (progName, arguments);
+	
+	if (argBuildDir.getNumOccurrences () > 0 && argInputFiles.getNumOccurrences () > 0) {
+		CompileDb database;
+		if (!database.load (argBuildDir)) {
+			return 4;
+		}
+		
+		QString firstInput = QString::fromStdString (*std::begin (argInputFiles));
+		std::vector< std::string > flags = database.flagsForHeader (firstInput);
+		arguments.insert (arguments.end (), flags.begin (), flags.end ());
+	}
+	
+	std::string inputFile = addInputFiles (mapper);
+	arguments.push_back (inputFile);
+	QVector< GenConf > generators = generatorsFromArguments ();
+	
+	// The include prefix of the input is precompiled once, so each run
+	// only parses what follows it. Without a cache directory, the PCH is
+	// kept in a temporary one.
+	QTemporaryDir temporaryDir;
+	QString pchDir = temporaryDir.path ();
+	if (argCacheDir.getNumOccurrences () > 0) {
+		pchDir = QString::fromStdString (argCacheDir) + QStringLiteral("/pch");
+	}
+	
+	std::unique_ptr< PchCache > pchCache (new PchCache (pchDir));
+	Compiler compiler (nullptr);
+	compiler.setPchCache (pchCache.get ());
+	LuaGenerator::precompileBuiltinScripts ();
+	
+	if (!compiler.prepare (&mapper, arguments)) {
+		return 1;
+	}
+	
+	// 
+	FileWatcher watcher;
+	QStringList changed;
+	while (true) {
+		std::vector< std::pair< std::string, int > > times;
+		std::vector< std::pair< std::string, bool > > written;
+		QTime timeTotal;
+		timeTotal.start ();
+		
+		// Files modified from here on may have been read in their old state
+		QDateTime started = QDateTime::currentDateTime ();
+		
+		// If a precompiled header has changed, it's rebuilt by a fresh
+		// cache. Everything else is re-read by a fresh file manager.
+		std::shared_ptr< const PchInfo > pch = compiler.pch ();
+		for (int i = 0; pch && i < pch->dependencies.length (); i++) {
+			if (changed.contains (QFileInfo (pch->dependencies.at (i)).absoluteFilePath ())) {
+				pchCache.reset (new PchCache (pchDir));
+				compiler.setPchCache (pchCache.get ());
+				break;
+			}
+			
+		}
+		
+		Definitions definitions (sourceFileList ());
+		compiler.setDefinitions (&definitions);
+		compiler.setFileManager (nullptr);
+		compiler.setMainFile (inputFile);
+		times.emplace_back ("init", timeTotal.elapsed ());
+		
+		// Errors are reported, but don't end watching
+		if (compiler.run ()) {
+			definitions.parsingComplete ();
+			times.emplace_back ("parse", timeTotal.elapsed ());
+			
+			if (generateOutputs (definitions, compiler, generators, timeTotal, times, written)) {
+				writeDepFile (DepFile::dependencies (compiler, generators), generators);
+				printTimes (timeTotal.elapsed (), times, written, definitions.timing ());
+				printTypeNameStats (definitions);
+			}
+			
+		}
+		
+		// Watch everything the run has read
+		QStringList files = DepFile::dependencies (compiler, generators);
+		if (pch) {
+			files.append (pch->dependencies);
+		}
+		
+		watcher.setFiles (sourceFileList () + files, started);
+		changed = watcher.wait ();
+		if (changed.isEmpty ()) {
+			return 6;
+		}
+		
+	}
+	
+}
+
+static int runTria (const char *progName, FileMapper &mapper) {
 	std::vector< std::pair< std::string, int > > times;
+	std::vector< std::pair< std::string, bool > > written;
 	std::vector< std::string > arguments;
-	FileMapper mapper;
 	
 	QTime timeTotal;
 	timeTotal.start ();
 	
-	// Parse arguments
-	const char *helpTitle = "Tria by the NuriaProject, built on " __DATE__ " " __TIME__;
-	llvm::cl::ParseCommandLineOptions (argc, argv, helpTitle);
-	initClangArguments (argv[0], arguments);
+	// 
+	if (argBatch.getNumOccurrences () > 0) {
+		return runBatch (progName, mapper);
+	}
+	
+	if (argMerge.getNumOccurrences () > 0) {
+		if (argFromAst.getNumOccurrences () > 0 || argFromDefs.getNumOccurrences () > 0 ||
+		    argEmitDefs.getNumOccurrences () > 0 || argWatch) {
+			qCritical() << "-merge can't be combined with -from-ast, -from-defs, -emit-defs or -watch";
+			return 4;
+		}
+		
+		if (argInputFiles.getNumOccurrences () < 1) {
+			qCritical() << "-merge expects the definitions files to merge as inputs";
+			return 4;
+		}
+		
+		return runMerge ();
+	}
+	
+	if (argFromDefs.getNumOccurrences () > 0) {
+		if (argFromAst.getNumOccurrences () > 0 || argEmitDefs.getNumOccurrences () > 0 ||
+		    argInputFiles.getNumOccurrences () > 0) {
+			qCritical() << "-from-defs can't be combined with input files, -from-ast or -emit-defs";
+			return 4;
+		}
+		
+		return runFromDefs ();
+	}
+	
+	if (argFromAst.getNumOccurrences () > 0) {
+		return runFromAst ();
+	}
+	
+	if (argWatch) {
+		if (argServer.getNumOccurrences () > 0 || argFromAst.getNumOccurrences () > 0 || argLuaShell ||
+		    argEmitDefs.getNumOccurrences () > 0) {
+			qCritical() << "-watch can't be combined with -server, -from-ast, -emit-defs or -shell";
+			return 4;
+		}
+		
+		return runWatch (progName, mapper);
+	}
+	
+	initClangArguments (progName, arguments);
+	
+	// Use the flags of the first input
+	if (argBuildDir.getNumOccurrences () > 0 && argInputFiles.getNumOccurrences () > 0) {
+		CompileDb database;
+		if (!database.load (argBuildDir)) {
+			return 4;
+		}
+		
+		QString firstInput = QString::fromStdString (*std::begin (argInputFiles));
+		std::vector< std::string > flags = database.flagsForHeader (firstInput);
+		arguments.insert (arguments.end (), flags.begin (), flags.end ());
+	}
+	
 	std::string inputFile = addInputFiles (mapper);
 	arguments.push_back (inputFile);
 	
 	// 
 	QVector< GenConf > generators = generatorsFromArguments ();
-	mapper.mapRecursive (QDir (":/headers/"), QStringLiteral("/builtins/"));
 	
 	// Create tool instance
 	Definitions definitions (sourceFileList ());
+	std::unique_ptr< PchCache > pchCache (createPchCache ());
+	std::unique_ptr< ResultCache > resultCache (createResultCache ());
 	Compiler compiler (&definitions);
-	if (!compiler.prepare (&mapper, arguments)) {
+	compiler.setPchCache (pchCache.get ());
+	
+	// If there's nothing to introspect, the generators run on the empty
+	// definitions right away. Custom generators may use more than that.
+	bool skipParsing = (LuaGenerator::allBuiltin (generators) && argEmitDefs.getNumOccurrences () < 1 &&
+	                    !TriaAction::mayIntrospect (sourceFileList ()));
+	times.emplace_back ("prescan", timeTotal.elapsed ());
+	
+	if (!skipParsing && !compiler.prepare (&mapper, arguments)) {
 		return 1;
 	}
 	
-	// Run it
 	times.emplace_back ("init", timeTotal.elapsed ());
-	if (!compiler.run ()) {
+	
+	// Look for a cached result first. A hit has no definitions to emit.
+	QByteArray cacheKey;
+	QVector< QByteArray > outputs;
+	if (resultCache && !skipParsing && argEmitDefs.getNumOccurrences () < 1) {
+		cacheKey = resultCache->computeKey (compiler, generators);
+		times.emplace_back ("hash", timeTotal.elapsed ());
+	}
+	
+	if (!cacheKey.isEmpty () && resultCache->lookup (cacheKey, outputs)) {
+		for (int i = 0; i < generators.length (); i++) {
+			if (!writeOutput (generators.at (i).outFile, outputs.at (i), written)) {
+				return 5;
+			}
+			
+		}
+		
+		// The hashing run has read all dependencies
+		if (!writeDepFile (DepFile::dependencies (compiler, generators), generators)) {
+			return 5;
+		}
+		
+		times.emplace_back ("cached outputs", timeTotal.elapsed ());
+		printTimes (timeTotal.elapsed (), times, written, nullptr);
+		printCacheStats (resultCache.get ());
+		return 0;
+	}
+	
+	// Run it
+	if (!skipParsing && !compiler.run ()) {
 		return 2;
 	}
 	
@@ -228,18 +775,138 @@ int main (int argc, const char **argv) {
 	definitions.parsingComplete ();
 	times.emplace_back ("parse", timeTotal.elapsed ());
 	
-	// Run generators
+	if (!emitDefinitions (definitions, compiler)) {
+		return 5;
+	}
+	
+	// Run generators. Outputs are kept for the cache, or to compare them to
+	// the existing files.
 	LuaGenerator luaGenerator (&definitions, &compiler);
 	for (int i = 0; i < generators.length (); i++) {
 		const GenConf &conf = generators.at (i);
-		if (!luaGenerator.generate (conf)) {
-			return 5;
+		if (cacheKey.isEmpty () && !argWriteIfChanged) {
+			if (!luaGenerator.generate (conf)) {
+				return 5;
+			}
+			
+		} else {
+			outputs.append (QByteArray ());
+			if (!luaGenerator.generate (conf, outputs.last ())) {
+				LuaGenerator::removeOutput (conf.outFile);
+				return 5;
+			} else if (!writeOutput (conf.outFile, outputs.last (), written)) {
+				return 5;
+			}
+			
 		}
 		
 		times.emplace_back (conf.luaScript.toStdString (), timeTotal.elapsed ());
 	}
 	
+	if (!cacheKey.isEmpty ()) {
+		resultCache->store (cacheKey, outputs);
+	}
+	
+	QStringList dependencies = DepFile::dependencies (compiler, generators);
+	if (skipParsing) {
+		dependencies = sourceFileList () + dependencies;
+	}
+	
+	if (!writeDepFile (dependencies, generators)) {
+		return 5;
+	}
+	
 	// 
-	printTimes (timeTotal.elapsed (), times, definitions);
+	printTimes (timeTotal.elapsed (), times, written, definitions.timing ());
+	printTypeNameStats (definitions);
+	printCacheStats (resultCache.get ());
 	return 0;
 }
+
+static void makeAbsolute (llvm::cl::list< std::string > &paths) {
+	for (std::string &cur : paths) {
+		cur = QFileInfo (QString::fromStdString (cur)).absoluteFilePath ().toStdString ();
+	}
+	
+}
+
+// Jobs parse their arguments on top of the ones of the server, and LLVM
+// can't reset options. Thus the server only takes include paths.
+static bool checkServerOptions () {
+	llvm::StringMap< llvm::cl::Option * > options;
+	llvm::cl::getRegisteredOptions (options);
+	
+	bool valid = (argInputFiles.getNumOccurrences () < 1);
+	for (auto it = options.begin (), end = options.end (); it != end; ++it) {
+		llvm::cl::Option *option = it->getValue ();
+		if (option != &argServer && option != &argIncludeDirs && option != &argSysDirs &&
+		    option->getNumOccurrences () > 0) {
+			valid = false;
+		}
+		
+	}
+	
+	if (!valid) {
+		qCritical() << "-server only accepts -I and -isystem as further arguments";
+	}
+	
+	return valid;
+}
+
+static int runServer (FileMapper &mapper) {
+	if (!checkServerOptions ()) {
+		return 4;
+	}
+	
+	// Include paths passed to the server apply to all jobs. Make them
+	// absolute, as jobs run in the working directory of the client.
+	makeAbsolute (argIncludeDirs);
+	makeAbsolute (argSysDirs);
+	
+	// Compile the built-in generators once
+	LuaGenerator::precompileBuiltinScripts ();
+	
+	// Jobs run in a fork()'d process, and thus parse their arguments freshly.
+	// Each job gets a fresh file manager: A stat cache kept by the server
+	// would outlive changes to the headers. The built-in headers stay
+	// mapped in memory.
+	auto handler = [&mapper](int argc, const char **argv) {
+		const char *helpTitle = "Tria by the NuriaProject, built on " __DATE__ " " __TIME__;
+		llvm::cl::ParseCommandLineOptions (argc, argv, helpTitle);
+		return runTria (argv[0], mapper);
+	};
+	
+	TriaServer server (argServer, handler);
+	if (!server.listen ()) {
+		return 6;
+	}
+	
+	return server.run ();
+}
+
+int main (int argc, const char **argv) {
+	FileMapper mapper;
+	
+	// Let a running server do the job if there's one
+	int serverResult = 0;
+	if (TriaServer::forward (argc, argv, serverResult)) {
+		return serverResult;
+	}
+	
+	// Parse arguments
+	const char *helpTitle = "Tria by the NuriaProject, built on " __DATE__ " " __TIME__;
+	llvm::cl::ParseCommandLineOptions (argc, argv, helpTitle);
+	
+	// On Linux, the headers of the Clang installation are used instead.
+	// See initClangArguments().
+#ifndef Q_OS_LINUX
+	mapper.mapRecursive (QDir (":/headers/"), QStringLiteral("/builtins/"));
+#endif
+	
+	// 
+	if (argServer.getNumOccurrences () > 0) {
+		return runServer (mapper);
+	}
+	
+	return runTria (argv[0], mapper);
+}
@@ -0,0 +1,330 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pchcache.hpp"
+
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/MultiplexConsumer.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendActions.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/Version.h>
+
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+#include "triaastconsumer.hpp"
+#include "triaaction.hpp"
+#include "compiler.hpp"
+
+namespace {
+
+// Builds the PCH, while letting a TriaASTConsumer collect the declared and
+// avoided types of the precompiled headers.
+class PchAction : public clang::GeneratePCHAction {
+public:
+	
+	PchAction (Definitions *definitions)
+		: m_definitions (definitions)
+	{ }
+	
+protected:
+
+#if CLANG_VERSION_MINOR < 6
+	typedef clang::ASTConsumer *CreateAstConsumerResultType;
+#else
+	typedef std::unique_ptr< clang::ASTConsumer > CreateAstConsumerResultType;
+#endif
+
+	CreateAstConsumerResultType CreateASTConsumer (clang::CompilerInstance &ci,
+	                                               llvm::StringRef fileName) override {
+		TriaAction::configureLangOpts (ci);
+		
+		CreateAstConsumerResultType pchConsumer = GeneratePCHAction::CreateASTConsumer (ci, fileName);
+		if (!pchConsumer) {
+			return pchConsumer;
+		}
+		
+		//
+		TriaASTConsumer *collector = new TriaASTConsumer (ci, fileName, QStringList (), false,
+		                                                  std::string (), this->m_definitions);
+		
+#if CLANG_VERSION_MINOR < 6
+		std::vector< clang::ASTConsumer * > consumers { pchConsumer, collector };
+		return new clang::MultiplexConsumer (consumers);
+#else
+		std::vector< std::unique_ptr< clang::ASTConsumer > > consumers;
+		consumers.push_back (std::move (pchConsumer));
+		consumers.emplace_back (collector);
+		return std::unique_ptr< clang::ASTConsumer > (new clang::MultiplexConsumer (std::move (consumers)));
+#endif
+	}
+	
+private:
+	Definitions *m_definitions;
+	
+};
+
+}
+
+PchCache::PchCache (const QString &directory)
+	: m_directory (directory)
+{
+	
+	QDir ().mkpath (directory);
+	
+}
+
+static QByteArray directiveArgument (const QByteArray &directive, const char *name) {
+	int length = qstrlen (name);
+	if (!directive.startsWith (name) || directive.length () <= length ||
+	    (directive.at (length) != ' ' && directive.at (length) != '\t' && directive.at (length) != '<')) {
+		return QByteArray ();
+	}
+	
+	return directive.mid (length).trimmed ();
+}
+
+QByteArray PchCache::includePrefix (const QString &header) {
+	QFile file (header);
+	if (!file.open (QIODevice::ReadOnly)) {
+		return QByteArray ();
+	}
+	
+	//
+	QByteArray prefix;
+	QByteArray guard;
+	bool inComment = false;
+	
+	while (!file.atEnd ()) {
+		QByteArray line = file.readLine ().trimmed ();
+		
+		// Skip comments and empty lines
+		if (inComment) {
+			inComment = !line.contains ("*/");
+			continue;
+		} else if (line.isEmpty () || line.startsWith ("//")) {
+			continue;
+		} else if (line.startsWith ("/*")) {
+			inComment = !line.contains ("*/");
+			continue;
+		} else if (!line.startsWith ('#')) {
+			break;
+		}
+		
+		// Include guard or a system include?
+		QByteArray directive = line.mid (1).trimmed ();
+		QByteArray include = directiveArgument (directive, "include");
+		QByteArray ifndef = directiveArgument (directive, "ifndef");
+		QByteArray define = directiveArgument (directive, "define");
+		
+		if (include.startsWith ('<') && include.indexOf ('>') > 1) {
+			prefix.append ("#include ");
+			prefix.append (include.left (include.indexOf ('>') + 1));
+			prefix.append ('\n');
+		} else if (prefix.isEmpty () && guard.isEmpty () && !ifndef.isEmpty ()) {
+			guard = ifndef;
+		} else if (prefix.isEmpty () && !guard.isEmpty () && define == guard) {
+			continue;
+		} else if (prefix.isEmpty () && directive == "pragma once") {
+			continue;
+		} else {
+			break;
+		}
+		
+	}
+	
+	return prefix;
+}
+
+QByteArray PchCache::cacheKey (const std::vector< std::string > &arguments, const QByteArray &prefix) {
+	QCryptographicHash hash (QCryptographicHash::Sha1);
+	
+	// The PCH format changes with Clang, what tria collects with tria.
+	hash.addData (QByteArray (CLANG_VERSION_STRING " " __DATE__ " " __TIME__));
+	
+	// All arguments but the main file
+	for (size_t i = 0; i + 1 < arguments.size (); i++) {
+		hash.addData (arguments[i].c_str (), arguments[i].length () + 1);
+	}
+	
+	hash.addData (prefix);
+	return hash.result ().toHex ();
+}
+
+static void readTypes (const QString &path, PchInfo &info) {
+	QFile file (path);
+	if (!file.open (QIODevice::ReadOnly)) {
+		return;
+	}
+	
+	while (!file.atEnd ()) {
+		QByteArray line = file.readLine ();
+		line.chop (1);
+		
+		QString type = QString::fromUtf8 (line.mid (2));
+		if (line.startsWith ("D ")) {
+			info.declaredTypes.insert (type);
+		} else if (line.startsWith ("A ")) {
+			info.avoidedTypes.insert (type);
+		}
+		
+	}
+	
+}
+
+bool PchCache::readEntry (const QString &base, PchInfo &info) {
+	QFile deps (base + QStringLiteral(".deps"));
+	if (!QFile::exists (base + QStringLiteral(".pch")) || !deps.open (QIODevice::ReadOnly)) {
+		return false;
+	}
+	
+	// Each line is "<mtime> <size> <path>"
+	while (!deps.atEnd ()) {
+		QByteArray line = deps.readLine ();
+		line.chop (1);
+		
+		QList< QByteArray > fields = line.split (' ');
+		if (fields.length () < 3) {
+			return false;
+		}
+		
+		QString path = QString::fromUtf8 (line.mid (fields.at (0).length () + fields.at (1).length () + 2));
+		QFileInfo fileInfo (path);
+		if (!fileInfo.exists () || fileInfo.lastModified ().toTime_t () != fields.at (0).toLongLong () ||
+		    fileInfo.size () != fields.at (1).toLongLong ()) {
+			return false;
+		}
+		
+		info.dependencies.append (path);
+	}
+	
+	//
+	info.path = (base + QStringLiteral(".pch")).toStdString ();
+	readTypes (base + QStringLiteral(".types"), info);
+	return true;
+}
+
+static bool writeFile (const QString &path, const QByteArray &data) {
+	QSaveFile file (path);
+	if (!file.open (QIODevice::WriteOnly) || file.write (data) != data.length ()) {
+		return false;
+	}
+	
+	return file.commit ();
+}
+
+bool PchCache::build (FileMapper *mapper, std::vector< std::string > arguments,
+                      const QByteArray &prefix, const QString &base, PchInfo &info) {
+	QString headerPath = base + QStringLiteral(".hpp");
+	if (!writeFile (headerPath, prefix)) {
+		return false;
+	}
+	
+	// Run
+	Definitions definitions ((QStringList ()));
+	Compiler compiler (&definitions);
+	arguments.back () = headerPath.toStdString ();
+	
+	if (!compiler.prepare (mapper, arguments)) {
+		return false;
+	}
+	
+	PchAction action (&definitions);
+	info.path = (base + QStringLiteral(".pch")).toStdString ();
+	compiler.invocation ()->getFrontendOpts ().OutputFile = info.path;
+	
+	if (!compiler.run (action)) {
+		QFile::remove (QString::fromStdString (info.path));
+		return false;
+	}
+	
+	// Store the files it depends on as seen by Clang. Built-in headers
+	// are part of the binary.
+	QByteArray deps;
+	clang::SourceManager &sm = compiler.compiler ()->getSourceManager ();
+	for (auto it = sm.fileinfo_begin (), end = sm.fileinfo_end (); it != end; ++it) {
+		const clang::FileEntry *entry = it->first;
+		QString path = QString::fromUtf8 (entry->getName ());
+		
+		if (path.startsWith (QLatin1String ("/builtins/")) || !QFileInfo (path).exists ()) {
+			continue;
+		}
+		
+		deps.append (QByteArray::number (qint64 (entry->getModificationTime ())));
+		deps.append (' ');
+		deps.append (QByteArray::number (qint64 (entry->getSize ())));
+		deps.append (' ');
+		deps.append (path.toUtf8 ());
+		deps.append ('\n');
+		info.dependencies.append (path);
+	}
+	
+	// Store types
+	QByteArray types;
+	info.declaredTypes = definitions.declaredTypes ();
+	info.avoidedTypes = definitions.avoidedTypes ();
+	
+	for (const QString &cur : info.declaredTypes) {
+		types.append ("D " + cur.toUtf8 () + "\n");
+	}
+	
+	for (const QString &cur : info.avoidedTypes) {
+		types.append ("A " + cur.toUtf8 () + "\n");
+	}
+	
+	// The .deps file marks the entry as complete, so write it last.
+	return (writeFile (base + QStringLiteral(".types"), types) &&
+	        writeFile (base + QStringLiteral(".deps"), deps));
+}
+
+std::shared_ptr< const PchInfo > PchCache::lookup (FileMapper *mapper, const std::vector< std::string > &arguments) {
+	QByteArray prefix = includePrefix (QString::fromStdString (arguments.back ()));
+	if (prefix.isEmpty ()) {
+		return nullptr;
+	}
+	
+	// Only one thread looks up or builds at a time. All others most likely
+	// wait for the same PCH anyway.
+	QByteArray key = cacheKey (arguments, prefix);
+	std::lock_guard< std::mutex > lock (this->m_mutex);
+	
+	auto it = this->m_entries.constFind (key);
+	if (it != this->m_entries.constEnd ()) {
+		return *it;
+	}
+	
+	// Look in the cache directory, build it if it's missing or outdated.
+	std::shared_ptr< PchInfo > info = std::make_shared< PchInfo > ();
+	QString base = this->m_directory + QLatin1Char ('/') + QString::fromLatin1 (key);
+	
+	if (!readEntry (base, *info)) {
+		*info = PchInfo ();
+		if (!build (mapper, arguments, prefix, base, *info)) {
+			qWarning() << "Failed to build precompiled header for" << arguments.back ().c_str ();
+			info = nullptr;
+		}
+		
+	}
+	
+	this->m_entries.insert (key, info);
+	return info;
+}
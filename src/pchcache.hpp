@@ -0,0 +1,90 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PCHCACHE_HPP
+#define PCHCACHE_HPP
+
+#include "definitions.hpp"
+
+#include <QByteArray>
+#include <QString>
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+
+class FileMapper;
+
+/**
+ * A precompiled header of an include prefix.
+ */
+struct PchInfo {
+	std::string path;
+	
+	// Files the PCH was built from
+	QStringList dependencies;
+	
+	// What TriaASTConsumer found in the headers of the PCH, as these
+	// declarations won't be passed to the consumer of the actual run.
+	StringSet declaredTypes;
+	StringSet avoidedTypes;
+	
+};
+
+/**
+ * Cache of precompiled headers. Most headers start with a list of includes
+ * of (Qt) system headers, which make up most of the parsing time. This list,
+ * the include prefix, is precompiled once and then re-used by all runs
+ * sharing it.
+ *
+ * Entries are keyed by the compiler arguments and the include prefix. An
+ * entry is rebuilt if any file it was built from has been modified since.
+ * Lookups are thread-safe.
+ */
+class PchCache {
+public:
+	
+	PchCache (const QString &directory);
+	
+	/**
+	 * Returns the include prefix of \a header: All #include <...>
+	 * directives preceding the first other code, apart from comments and
+	 * the include guard. Returns an empty array if there's none.
+	 */
+	static QByteArray includePrefix (const QString &header);
+	
+	/**
+	 * Returns a PCH for the main file of \a arguments, which is the last
+	 * argument. Builds it if it doesn't exist yet or is out of date.
+	 * Returns \c nullptr if the main file has no include prefix, or if
+	 * building the PCH failed.
+	 */
+	std::shared_ptr< const PchInfo > lookup (FileMapper *mapper, const std::vector< std::string > &arguments);
+	
+private:
+	
+	QByteArray cacheKey (const std::vector< std::string > &arguments, const QByteArray &prefix);
+	bool readEntry (const QString &base, PchInfo &info);
+	bool build (FileMapper *mapper, std::vector< std::string > arguments,
+	            const QByteArray &prefix, const QString &base, PchInfo &info);
+	
+	QString m_directory;
+	std::mutex m_mutex;
+	QMap< QByteArray, std::shared_ptr< PchInfo > > m_entries;
+	
+};
+
+#endif // PCHCACHE_HPP
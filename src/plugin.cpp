@@ -0,0 +1,167 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <clang/Frontend/FrontendPluginRegistry.h>
+#include <clang/Frontend/MultiplexConsumer.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Basic/Diagnostic.h>
+#include <clang/Basic/Version.h>
+
+#include <QStringList>
+#include <QString>
+#include <QVector>
+#include <memory>
+
+#include "triaastconsumer.hpp"
+#include "luagenerator.hpp"
+#include "definitions.hpp"
+#include "compiler.hpp"
+
+// Tria as Clang plugin. Instead of parsing the input again, tria collects
+// its definitions while Clang compiles a translation unit including it:
+//   clang++ -DTRIA_RUN -fplugin=libtria.so -Xclang -add-plugin -Xclang tria
+//           -Xclang -plugin-arg-tria -Xclang cxx-output=foo_tria.cpp ...
+namespace {
+
+struct PluginOptions {
+	QStringList inputs;
+	QVector< GenConf > generators;
+	QStringList introspectBases;
+	bool introspectAll = false;
+	std::string globalClass;
+};
+
+void reportError (clang::DiagnosticsEngine &diag, const char *message, const std::string &argument) {
+	unsigned id = diag.getCustomDiagID (clang::DiagnosticsEngine::Error, message);
+	diag.Report (id) << argument;
+}
+
+// Runs the generators once the translation unit has been parsed. Comes after
+// the TriaASTConsumer in the multiplexer, so the definitions are complete.
+class GeneratorConsumer : public clang::ASTConsumer {
+public:
+	
+	GeneratorConsumer (clang::CompilerInstance &ci, Definitions *definitions, const QVector< GenConf > &generators)
+		: m_ci (ci), m_definitions (definitions), m_generators (generators)
+	{ }
+	
+	void HandleTranslationUnit (clang::ASTContext &) override {
+		clang::DiagnosticsEngine &diag = this->m_ci.getDiagnostics ();
+		if (diag.hasErrorOccurred ()) {
+			return;
+		}
+		
+		// 
+		this->m_definitions->parsingComplete ();
+		Compiler compiler (this->m_definitions.get ());
+		compiler.useInstance (&this->m_ci);
+		
+		LuaGenerator luaGenerator (this->m_definitions.get (), &compiler);
+		for (const GenConf &cur : this->m_generators) {
+			if (!luaGenerator.generate (cur)) {
+				reportError (diag, "tria: Lua generator %0 failed", cur.luaScript.toStdString ());
+				return;
+			}
+			
+		}
+		
+	}
+	
+private:
+	clang::CompilerInstance &m_ci;
+	std::unique_ptr< Definitions > m_definitions;
+	QVector< GenConf > m_generators;
+	
+};
+
+class TriaPluginAction : public clang::PluginASTAction {
+protected:
+
+#if CLANG_VERSION_MINOR < 6
+	typedef clang::ASTConsumer *CreateAstConsumerResultType;
+#else
+	typedef std::unique_ptr< clang::ASTConsumer > CreateAstConsumerResultType;
+#endif
+
+	CreateAstConsumerResultType CreateASTConsumer (clang::CompilerInstance &ci,
+	                                               llvm::StringRef fileName) override {
+		QStringList inputs = this->m_options.inputs;
+		if (inputs.isEmpty ()) {
+			inputs.append (QString::fromUtf8 (fileName.data (), fileName.size ()));
+		}
+		
+		// 
+		Definitions *definitions = new Definitions (inputs);
+		TriaASTConsumer *collector = new TriaASTConsumer (ci, fileName, this->m_options.introspectBases,
+		                                                  this->m_options.introspectAll,
+		                                                  this->m_options.globalClass, definitions);
+		GeneratorConsumer *generator = new GeneratorConsumer (ci, definitions, this->m_options.generators);
+		
+#if CLANG_VERSION_MINOR < 6
+		std::vector< clang::ASTConsumer * > consumers { collector, generator };
+		return new clang::MultiplexConsumer (consumers);
+#else
+		std::vector< std::unique_ptr< clang::ASTConsumer > > consumers;
+		consumers.emplace_back (collector);
+		consumers.emplace_back (generator);
+		return std::unique_ptr< clang::ASTConsumer > (new clang::MultiplexConsumer (std::move (consumers)));
+#endif
+	}
+	
+	bool ParseArgs (const clang::CompilerInstance &ci, const std::vector< std::string > &arguments) override {
+		for (const std::string &cur : arguments) {
+			size_t delim = cur.find ('=');
+			std::string name = cur.substr (0, delim);
+			QString value = (delim == std::string::npos) ? QString () : QString::fromStdString (cur.substr (delim + 1));
+			
+			if (name == "input") {
+				this->m_options.inputs.append (value);
+			} else if (name == "cxx-output") {
+				this->m_options.generators.append ({ QStringLiteral(":/lua/nuria.lua"), value, QString () });
+			} else if (name == "json-output") {
+				this->m_options.generators.append ({ QStringLiteral(":/lua/json.lua"), value, QString () });
+			} else if (name == "lua-generator") {
+				GenConf genConf;
+				if (!LuaGenerator::parseConfig (value.toStdString (), genConf)) {
+					return false;
+				}
+				
+				this->m_options.generators.append (genConf);
+			} else if (name == "introspect-all") {
+				this->m_options.introspectAll = true;
+			} else if (name == "introspect-inheriting") {
+				this->m_options.introspectBases += value.split (QLatin1Char (','), QString::SkipEmptyParts);
+			} else if (name == "global-class") {
+				this->m_options.globalClass = value.toStdString ();
+			} else {
+				reportError (ci.getDiagnostics (), "tria: Unknown plugin argument '%0'", cur);
+				return false;
+			}
+			
+		}
+		
+		return true;
+	}
+	
+private:
+	PluginOptions m_options;
+	
+};
+
+}
+
+static clang::FrontendPluginRegistry::Add< TriaPluginAction > registerTria ("tria", "Runs tria on the parsed code");
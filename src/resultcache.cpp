@@ -0,0 +1,305 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "resultcache.hpp"
+
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/FrontendAction.h>
+#include <clang/Basic/SourceManager.h>
+#include <clang/Lex/Preprocessor.h>
+#include <clang/Basic/Version.h>
+
+#include <QCryptographicHash>
+#include <QDirIterator>
+#include <QDataStream>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDateTime>
+#include <QDebug>
+#include <QFile>
+#include <QDir>
+
+#include <algorithm>
+#include <cstdio>
+
+#include "triaaction.hpp"
+#include "compiler.hpp"
+
+#ifdef Q_OS_UNIX
+#include <utime.h>
+#endif
+
+namespace {
+
+// Feeds the pre-processed token stream of the main file into a hash. Line
+// markers are included, as generators may use source locations.
+class TokenHashAction : public clang::PreprocessorFrontendAction {
+public:
+	
+	TokenHashAction (QCryptographicHash *hash)
+		: m_hash (hash)
+	{ }
+	
+protected:
+	
+	bool BeginSourceFileAction (clang::CompilerInstance &ci, llvm::StringRef) override {
+		
+		// Errors are reported by the actual run
+		ci.getDiagnostics ().setSuppressAllDiagnostics (true);
+		return true;
+	}
+	
+	void ExecuteAction () override {
+		clang::CompilerInstance &ci = getCompilerInstance ();
+		clang::SourceManager &sm = ci.getSourceManager ();
+		clang::Preprocessor &pp = ci.getPreprocessor ();
+		TriaAction::configureLangOpts (ci);
+		
+		clang::Token token;
+		pp.EnterMainSourceFile ();
+		
+		do {
+			pp.Lex (token);
+			
+			if (token.isAtStartOfLine ()) {
+				clang::PresumedLoc loc = sm.getPresumedLoc (token.getLocation ());
+				if (loc.isValid ()) {
+					this->m_hash->addData (loc.getFilename ());
+					this->m_hash->addData (QByteArray::number (loc.getLine ()));
+				}
+				
+			}
+			
+			std::string spelling = pp.getSpelling (token);
+			this->m_hash->addData (spelling.c_str (), spelling.length () + 1);
+		} while (token.isNot (clang::tok::eof));
+		
+	}
+	
+private:
+	QCryptographicHash *m_hash;
+	
+};
+
+}
+
+ResultCache::ResultCache (const QString &directory, qint64 maxSize)
+	: m_directory (directory), m_maxSize (maxSize), m_hits (0), m_misses (0)
+{
+	
+	QDir ().mkpath (directory);
+	
+}
+
+ResultCache::~ResultCache () {
+	writeStats ();
+}
+
+static bool addScript (QCryptographicHash &hash, const QString &path) {
+	
+	// Built-in scripts are part of the tria version
+	if (path.startsWith (QLatin1String (":/"))) {
+		return true;
+	}
+	
+	QFile file (path);
+	if (!file.open (QIODevice::ReadOnly)) {
+		return false;
+	}
+	
+	hash.addData (file.readAll ());
+	return true;
+}
+
+QByteArray ResultCache::computeKey (Compiler &compiler, const QVector< GenConf > &generators) {
+	QCryptographicHash hash (QCryptographicHash::Sha1);
+	hash.addData (QByteArray (CLANG_VERSION_STRING " " __DATE__ " " __TIME__));
+	hash.addData (TriaAction::optionFingerprint ());
+	
+	// Arguments, but the program name
+	const std::vector< std::string > &arguments = compiler.arguments ();
+	for (size_t i = 1; i < arguments.size (); i++) {
+		hash.addData (arguments[i].c_str (), arguments[i].length () + 1);
+	}
+	
+	// Generators
+	for (const GenConf &cur : generators) {
+		if (cur.luaScript == QLatin1String ("SHELL") || !addScript (hash, cur.luaScript)) {
+			return QByteArray ();
+		}
+		
+		hash.addData (cur.luaScript.toUtf8 () + '\0' + cur.outFile.toUtf8 () + '\0' + cur.args.toUtf8 ());
+	}
+	
+	// Pre-process without the PCH, so the tokens of all headers are hashed.
+	clang::PreprocessorOptions &ppOpts = compiler.invocation ()->getPreprocessorOpts ();
+	std::string pch = ppOpts.ImplicitPCHInclude;
+	ppOpts.ImplicitPCHInclude.clear ();
+	
+	TokenHashAction action (&hash);
+	bool success = compiler.run (action);
+	ppOpts.ImplicitPCHInclude = pch;
+	
+	if (!success) {
+		return QByteArray ();
+	}
+	
+	return hash.result ().toHex ();
+}
+
+QString ResultCache::entryPath (const QByteArray &key) const {
+	QString name = QString::fromLatin1 (key);
+	return this->m_directory + QLatin1Char ('/') + name.left (2) + QLatin1Char ('/') + name;
+}
+
+bool ResultCache::lookup (const QByteArray &key, QVector< QByteArray > &outputs) {
+	QString path = entryPath (key);
+	QFile file (path);
+	
+	if (!file.open (QIODevice::ReadOnly)) {
+		this->m_misses++;
+		return false;
+	}
+	
+	QDataStream stream (&file);
+	stream >> outputs;
+	
+	if (stream.status () != QDataStream::Ok) {
+		this->m_misses++;
+		return false;
+	}
+	
+	// Mark as recently used
+#ifdef Q_OS_UNIX
+	::utime (QFile::encodeName (path).constData (), nullptr);
+#endif
+
+	this->m_hits++;
+	return true;
+}
+
+void ResultCache::store (const QByteArray &key, const QVector< QByteArray > &outputs) {
+	QString path = entryPath (key);
+	QDir ().mkpath (QFileInfo (path).absolutePath ());
+	
+	QSaveFile file (path);
+	if (!file.open (QIODevice::WriteOnly)) {
+		return;
+	}
+	
+	QDataStream stream (&file);
+	stream << outputs;
+	qint64 size = file.size ();
+	
+	if (!file.commit ()) {
+		return;
+	}
+	
+	// Evict old entries if the cache has grown too large
+	std::lock_guard< std::mutex > lock (this->m_mutex);
+	qint64 hits, misses, totalSize;
+	
+	this->m_storedSize += size;
+	readStats (hits, misses, totalSize);
+	if (totalSize + this->m_storedSize > this->m_maxSize) {
+		evict ();
+	}
+	
+}
+
+void ResultCache::readStats (qint64 &hits, qint64 &misses, qint64 &size) {
+	hits = misses = size = 0;
+	
+	QFile file (this->m_directory + QStringLiteral("/stats"));
+	if (file.open (QIODevice::ReadOnly)) {
+		QList< QByteArray > fields = file.readAll ().trimmed ().split (' ');
+		hits = fields.value (0).toLongLong ();
+		misses = fields.value (1).toLongLong ();
+		size = fields.value (2).toLongLong ();
+	}
+	
+}
+
+void ResultCache::writeStats () {
+	qint64 hits, misses, size;
+	
+	// Concurrent runs may lose an update here, which is fine for statistics
+	readStats (hits, misses, size);
+	hits += this->m_hits;
+	misses += this->m_misses;
+	size += this->m_storedSize;
+	
+	QSaveFile file (this->m_directory + QStringLiteral("/stats"));
+	if (file.open (QIODevice::WriteOnly)) {
+		file.write (QByteArray::number (hits) + ' ' + QByteArray::number (misses) + ' ' +
+		            QByteArray::number (size) + '\n');
+		file.commit ();
+	}
+	
+	this->m_hits = 0;
+	this->m_misses = 0;
+	this->m_storedSize = 0;
+}
+
+void ResultCache::evict () {
+	QVector< QFileInfo > entries;
+	qint64 size = 0;
+	
+	QDirIterator it (this->m_directory, QDir::Files, QDirIterator::Subdirectories);
+	while (it.hasNext ()) {
+		it.next ();
+		if (it.fileName () != QLatin1String ("stats")) {
+			entries.append (it.fileInfo ());
+			size += it.fileInfo ().size ();
+		}
+		
+	}
+	
+	// Remove the least recently used entries until the cache is at 90%
+	std::sort (entries.begin (), entries.end (), [](const QFileInfo &left, const QFileInfo &right) {
+		return left.lastModified () < right.lastModified ();
+	});
+	
+	qint64 limit = this->m_maxSize / 10 * 9;
+	for (int i = 0; i < entries.length () && size > limit; i++) {
+		if (QFile::remove (entries.at (i).filePath ())) {
+			size -= entries.at (i).size ();
+		}
+		
+	}
+	
+	// Store the actual size
+	qint64 hits, misses, oldSize;
+	readStats (hits, misses, oldSize);
+	this->m_storedSize = size - oldSize;
+}
+
+void ResultCache::printStats () {
+	qint64 hits, misses, size;
+	readStats (hits, misses, size);
+	
+	int runHits = this->m_hits;
+	int runMisses = this->m_misses;
+	hits += runHits;
+	misses += runMisses;
+	size += this->m_storedSize;
+	
+	printf ("Result cache:\n");
+	printf ("  %i hits, %i misses in this run\n", runHits, runMisses);
+	printf ("  %lli hits, %lli misses in total, %.1f of %.1f MiB used\n", hits, misses,
+	        double (size) / (1024. * 1024.), double (this->m_maxSize) / (1024. * 1024.));
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESULTCACHE_HPP
+#define RESULTCACHE_HPP
+
+#include "luagenerator.hpp"
+
+#include <QByteArray>
+#include <QVector>
+#include <atomic>
+#include <mutex>
+
+class Compiler;
+
+/**
+ * Cache of generator outputs. The key of an entry is made up of the token
+ * stream of the pre-processed input, the compiler arguments, the tria
+ * version and the generators with their scripts. On a hit, the stored
+ * outputs are used without ever parsing the input.
+ *
+ * If the cache grows larger than its maximum size, the least recently used
+ * entries are removed. Lookups and stores are thread-safe.
+ */
+class ResultCache {
+public:
+	
+	ResultCache (const QString &directory, qint64 maxSize);
+	
+	/** Writes the statistics of this run to the cache. */
+	~ResultCache ();
+	
+	/**
+	 * Computes the key of a run of \a compiler with \a generators by
+	 * pre-processing the main file. Returns an empty array if the run
+	 * can't be cached.
+	 */
+	QByteArray computeKey (Compiler &compiler, const QVector< GenConf > &generators);
+	
+	/** Looks up \a key. On a hit, returns \c true and fills \a outputs. */
+	bool lookup (const QByteArray &key, QVector< QByteArray > &outputs);
+	
+	/** Stores \a outputs as result of \a key. */
+	void store (const QByteArray &key, const QVector< QByteArray > &outputs);
+	
+	/** Prints hit and miss statistics to stdout. */
+	void printStats ();
+	
+private:
+	
+	QString entryPath (const QByteArray &key) const;
+	void readStats (qint64 &hits, qint64 &misses, qint64 &size);
+	void writeStats ();
+	void evict ();
+	
+	QString m_directory;
+	qint64 m_maxSize;
+	
+	// Of this run
+	std::atomic< int > m_hits;
+	std::atomic< int > m_misses;
+	qint64 m_storedSize = 0;
+	std::mutex m_mutex;
+	
+};
+
+#endif // RESULTCACHE_HPP
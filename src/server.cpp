@@ -0,0 +1,374 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "server.hpp"
+
+#include <QDataStream>
+#include <QByteArray>
+#include <QtGlobal>
+#include <QList>
+#include <QDebug>
+#include <QDir>
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <vector>
+
+#ifdef Q_OS_UNIX
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+
+const char *TriaServer::socketVariable = "TRIA_SERVER";
+
+TriaServer::TriaServer (const std::string &socketPath, JobHandler handler)
+	: m_path (socketPath), m_handler (handler)
+{
+
+}
+
+TriaServer::~TriaServer () {
+#ifdef Q_OS_UNIX
+	if (this->m_socket != -1) {
+		::close (this->m_socket);
+		::unlink (this->m_path.c_str ());
+	}
+#endif
+}
+
+#ifdef Q_OS_UNIX
+// Wire format of a job: The client first sends a single byte carrying its
+// stdin, stdout and stderr as SCM_RIGHTS, followed by a quint32 length and
+// a QDataStream of the working directory and the argument list.
+// The server answers with the qint32 exit code of the job.
+enum { PassedDescriptors = 3 };
+
+static bool writeFully (int fd, const char *data, size_t length) {
+	while (length > 0) {
+		ssize_t r = ::write (fd, data, length);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		
+		data += r;
+		length -= r;
+	}
+	
+	return true;
+}
+
+static bool readFully (int fd, char *data, size_t length) {
+	while (length > 0) {
+		ssize_t r = ::read (fd, data, length);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		
+		data += r;
+		length -= r;
+	}
+	
+	return true;
+}
+
+static bool sendDescriptors (int socket, const int *fds, int count) {
+	char payload = 0;
+	iovec iov = { &payload, 1 };
+	
+	char control[CMSG_SPACE(sizeof(int) * PassedDescriptors)];
+	memset (control, 0, sizeof(control));
+	
+	msghdr msg;
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+	
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+	memcpy (CMSG_DATA(cmsg), fds, sizeof(int) * count);
+	
+	return (::sendmsg (socket, &msg, 0) == 1);
+}
+
+static bool receiveDescriptors (int socket, int *fds, int count) {
+	char payload = 0;
+	iovec iov = { &payload, 1 };
+	
+	char control[CMSG_SPACE(sizeof(int) * PassedDescriptors)];
+	msghdr msg;
+	memset (&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+	
+	if (::recvmsg (socket, &msg, 0) != 1) {
+		return false;
+	}
+	
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int) * count)) {
+		return false;
+	}
+	
+	memcpy (fds, CMSG_DATA(cmsg), sizeof(int) * count);
+	return true;
+}
+
+static bool fillAddress (sockaddr_un &address, const std::string &path) {
+	memset (&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	
+	if (path.length () >= sizeof(address.sun_path)) {
+		return false;
+	}
+	
+	strcpy (address.sun_path, path.c_str ());
+	return true;
+}
+
+static bool hasOption (int argc, const char **argv, const char *name) {
+	size_t length = strlen (name);
+	for (int i = 1; i < argc; i++) {
+		const char *cur = argv[i];
+		if (cur[0] != '-') {
+			continue;
+		}
+		
+		cur += (cur[1] == '-') ? 2 : 1;
+		if (!strncmp (cur, name, length) && (cur[length] == '\0' || cur[length] == '=')) {
+			return true;
+		}
+		
+	}
+	
+	return false;
+}
+
+// Interactive and long-running invocations always run locally. The server
+// itself is never forwarded.
+static bool isLocalInvocation (int argc, const char **argv) {
+	return (hasOption (argc, argv, "server") || hasOption (argc, argv, "watch") ||
+	        hasOption (argc, argv, "shell"));
+}
+
+#endif
+
+bool TriaServer::forward (int argc, const char **argv, int &exitCode) {
+#ifdef Q_OS_UNIX
+	const char *path = ::getenv (socketVariable);
+	if (!path || !*path || isLocalInvocation (argc, argv)) {
+		return false;
+	}
+	
+	// Connect. If there's no server, fall back to a local run.
+	sockaddr_un address;
+	if (!fillAddress (address, path)) {
+		return false;
+	}
+	
+	int socket = ::socket (AF_UNIX, SOCK_STREAM, 0);
+	if (socket == -1) {
+		return false;
+	}
+	
+	if (::connect (socket, (sockaddr *)&address, sizeof(address)) != 0) {
+		::close (socket);
+		return false;
+	}
+	
+	// Serialize job
+	QByteArray job;
+	QDataStream stream (&job, QIODevice::WriteOnly);
+	QList< QByteArray > arguments;
+	for (int i = 0; i < argc; i++) {
+		arguments.append (QByteArray (argv[i]));
+	}
+	
+	stream << QDir::currentPath ().toLocal8Bit () << arguments;
+	
+	// Send it. Once the server has the job, there's no going back.
+	static const int fds[PassedDescriptors] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	quint32 length = job.length ();
+	fflush (stdout);
+	fflush (stderr);
+	
+	if (!sendDescriptors (socket, fds, PassedDescriptors) ||
+	    !writeFully (socket, (const char *)&length, sizeof(length)) ||
+	    !writeFully (socket, job.constData (), job.length ())) {
+		::close (socket);
+		return false;
+	}
+	
+	// Wait for the result
+	qint32 result = 0;
+	if (!readFully (socket, (char *)&result, sizeof(result))) {
+		fprintf (stderr, "tria: Lost connection to server %s\n", path);
+		result = 1;
+	}
+	
+	::close (socket);
+	exitCode = result;
+	return true;
+#else
+	Q_UNUSED(argc)
+	Q_UNUSED(argv)
+	Q_UNUSED(exitCode)
+	return false;
+#endif
+}
+
+bool TriaServer::listen () {
+#ifdef Q_OS_UNIX
+	sockaddr_un address;
+	if (!fillAddress (address, this->m_path)) {
+		qCritical() << "Server socket path too long:" << this->m_path.c_str ();
+		return false;
+	}
+	
+	// Remove stale socket of a previous server
+	::unlink (this->m_path.c_str ());
+	
+	this->m_socket = ::socket (AF_UNIX, SOCK_STREAM, 0);
+	if (this->m_socket == -1 ||
+	    ::bind (this->m_socket, (sockaddr *)&address, sizeof(address)) != 0 ||
+	    ::listen (this->m_socket, SOMAXCONN) != 0) {
+		qCritical() << "Failed to listen on" << this->m_path.c_str () << ":" << strerror (errno);
+		return false;
+	}
+	
+	// Finished jobs are reaped automatically
+	::signal (SIGCHLD, SIG_IGN);
+	return true;
+#else
+	qCritical() << "Server mode is not supported on this platform";
+	return false;
+#endif
+}
+
+int TriaServer::run () {
+#ifdef Q_OS_UNIX
+	while (true) {
+		int connection = ::accept (this->m_socket, nullptr, nullptr);
+		if (connection == -1) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			qCritical() << "Server: accept() failed:" << strerror (errno);
+			return 1;
+		}
+		
+		// 
+		handleConnection (connection);
+		::close (connection);
+	}
+	
+#endif
+	return 1;
+}
+
+void TriaServer::handleConnection (int connection) {
+#ifdef Q_OS_UNIX
+
+	// The supervisor waits for the actual job to finish and reports its
+	// exit code. This way, even a crashing job gets a proper answer.
+	pid_t supervisor = ::fork ();
+	if (supervisor != 0) {
+		return;
+	}
+	
+	::close (this->m_socket);
+	::signal (SIGCHLD, SIG_DFL);
+	
+	pid_t worker = ::fork ();
+	if (worker == 0) {
+		::_exit (runJob (connection));
+	}
+	
+	int status = 0;
+	qint32 result = 1;
+	while (worker > 0 && ::waitpid (worker, &status, 0) == -1 && errno == EINTR);
+	
+	if (worker > 0 && WIFEXITED(status)) {
+		result = WEXITSTATUS(status);
+	} else if (worker > 0 && WIFSIGNALED(status)) {
+		result = 128 + WTERMSIG(status);
+	}
+	
+	writeFully (connection, (const char *)&result, sizeof(result));
+	::_exit (0);
+#else
+	Q_UNUSED(connection)
+#endif
+}
+
+int TriaServer::runJob (int connection) {
+#ifdef Q_OS_UNIX
+	int fds[PassedDescriptors];
+	quint32 length = 0;
+	
+	if (!receiveDescriptors (connection, fds, PassedDescriptors) ||
+	    !readFully (connection, (char *)&length, sizeof(length))) {
+		return 1;
+	}
+	
+	QByteArray job (length, Qt::Uninitialized);
+	if (!readFully (connection, job.data (), length)) {
+		return 1;
+	}
+	
+	// Deserialize
+	QByteArray workingDirectory;
+	QList< QByteArray > arguments;
+	QDataStream stream (job);
+	stream >> workingDirectory >> arguments;
+	
+	if (stream.status () != QDataStream::Ok || arguments.isEmpty () ||
+	    ::chdir (workingDirectory.constData ()) != 0) {
+		return 1;
+	}
+	
+	// Take over the clients stdio
+	for (int i = 0; i < PassedDescriptors; i++) {
+		::dup2 (fds[i], i);
+		::close (fds[i]);
+	}
+	
+	std::vector< const char * > argv;
+	for (const QByteArray &cur : arguments) {
+		argv.push_back (cur.constData ());
+	}
+	
+	argv.push_back (nullptr);
+	
+	// Run it
+	int result = this->m_handler (arguments.length (), argv.data ());
+	
+	fflush (stdout);
+	fflush (stderr);
+	return result;
+#else
+	Q_UNUSED(connection)
+	return 1;
+#endif
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <functional>
+#include <string>
+
+/**
+ * Local job server. Keeps a warmed-up tria process around and runs jobs sent
+ * by clients over a UNIX domain socket.
+ *
+ * Every job runs in a process forked off the server, thus inheriting all state
+ * prepared by the server (Mapped headers, Lua byte-code, ...)
+ * without having to worry about left-overs of previous jobs. The client passes
+ * its stdin, stdout and stderr along, so output ends up where it would've in a
+ * local run.
+ */
+class TriaServer {
+public:
+	typedef std::function< int(int argc, const char **argv) > JobHandler;
+	
+	/** Name of the environment variable clients look for. */
+	static const char *socketVariable;
+	
+	TriaServer (const std::string &socketPath, JobHandler handler);
+	~TriaServer ();
+	
+	/** Starts listening on the socket. Returns \c true on success. */
+	bool listen ();
+	
+	/** Accepts and runs jobs. Only returns on error. */
+	int run ();
+	
+	/**
+	 * If the environment variable TRIA_SERVER points at a running server,
+	 * sends the command-line to it and waits for it to finish. Returns
+	 * \c true if the job was run by the server, in which case \a exitCode
+	 * has been set. Returns \c false if the job should be run locally.
+	 */
+	static bool forward (int argc, const char **argv, int &exitCode);
+	
+private:
+	void handleConnection (int connection);
+	int runJob (int connection);
+	
+	std::string m_path;
+	JobHandler m_handler;
+	int m_socket = -1;
+	
+};
+
+#endif // SERVER_HPP
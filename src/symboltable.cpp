@@ -0,0 +1,161 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "symboltable.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+Symbol::Symbol (const QString &string) {
+	QByteArray data = string.toUtf8 ();
+	this->m_id = SymbolTable::instance ()->intern (data.constData (), data.length ());
+}
+
+Symbol::Symbol (const char *string)
+	: m_id (SymbolTable::instance ()->intern (string, int (::strlen (string))))
+{
+
+}
+
+Symbol Symbol::fromId (quint32 id) {
+	Symbol symbol;
+	symbol.m_id = id;
+	return symbol;
+}
+
+const char *Symbol::data () const {
+	return SymbolTable::instance ()->data (this->m_id);
+}
+
+int Symbol::length () const {
+	return SymbolTable::instance ()->length (this->m_id);
+}
+
+QByteArray Symbol::utf8 () const {
+	return QByteArray::fromRawData (data (), length ());
+}
+
+QString Symbol::toString () const {
+	return QString::fromUtf8 (data (), length ());
+}
+
+bool Symbol::operator< (const Symbol &other) const {
+	if (this->m_id == other.m_id) {
+		return false;
+	}
+	
+	// Same order as QString for the ASCII names this is used with
+	int length = std::min (this->length (), other.length ());
+	int result = ::memcmp (data (), other.data (), length);
+	return (result < 0 || (result == 0 && this->length () < other.length ()));
+}
+
+SymbolTable::SymbolTable ()
+	: m_count (0)
+{
+	
+	for (int i = 0; i < MaxChunks; i++) {
+		this->m_chunks[i].store (nullptr, std::memory_order_relaxed);
+	}
+	
+	// Symbol 0 is the empty string
+	intern ("", 0);
+	
+}
+
+SymbolTable::~SymbolTable () {
+	for (int i = 0; i < MaxChunks; i++) {
+		delete[] this->m_chunks[i].load (std::memory_order_relaxed);
+	}
+	
+	for (char *block : this->m_blocks) {
+		delete[] block;
+	}
+	
+}
+
+SymbolTable *SymbolTable::instance () {
+	static SymbolTable table;
+	return &table;
+}
+
+const char *SymbolTable::store (const char *data, int length) {
+	
+	// Long strings get a block of their own
+	if (length + 1 > BlockSize) {
+		char *block = new char[length + 1];
+		this->m_blocks.push_back (block);
+		::memcpy (block, data, length);
+		block[length] = '\0';
+		return block;
+	}
+	
+	if (this->m_blockUsed + length + 1 > BlockSize) {
+		this->m_blocks.push_back (new char[BlockSize]);
+		this->m_blockUsed = 0;
+	}
+	
+	char *result = this->m_blocks.back () + this->m_blockUsed;
+	::memcpy (result, data, length);
+	result[length] = '\0';
+	this->m_blockUsed += length + 1;
+	return result;
+}
+
+quint32 SymbolTable::intern (const char *data, int length) {
+	std::lock_guard< std::mutex > lock (this->m_mutex);
+	
+	auto it = this->m_ids.constFind (QByteArray::fromRawData (data, length));
+	if (it != this->m_ids.constEnd ()) {
+		return *it;
+	}
+	
+	// Add the entry before publishing the new count
+	quint32 id = this->m_count.load (std::memory_order_relaxed);
+	Entry *chunk = this->m_chunks[id / EntriesPerChunk].load (std::memory_order_relaxed);
+	if (!chunk) {
+		chunk = new Entry[EntriesPerChunk];
+		this->m_chunks[id / EntriesPerChunk].store (chunk, std::memory_order_release);
+	}
+	
+	const char *stored = store (data, length);
+	chunk[id % EntriesPerChunk] = { stored, length };
+	this->m_ids.insert (QByteArray::fromRawData (stored, length), id);
+	this->m_size += length + 1;
+	this->m_count.store (id + 1, std::memory_order_release);
+	return id;
+}
+
+const SymbolTable::Entry &SymbolTable::entry (quint32 id) const {
+	Entry *chunk = this->m_chunks[id / EntriesPerChunk].load (std::memory_order_acquire);
+	return chunk[id % EntriesPerChunk];
+}
+
+const char *SymbolTable::data (quint32 id) const {
+	return entry (id).data;
+}
+
+int SymbolTable::length (quint32 id) const {
+	return entry (id).length;
+}
+
+int SymbolTable::count () const {
+	return this->m_count.load (std::memory_order_acquire);
+}
+
+qint64 SymbolTable::size () const {
+	return this->m_size;
+}
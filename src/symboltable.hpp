@@ -0,0 +1,128 @@
+/* Copyright (c) 2014-2015, The Nuria Project
+ * The NuriaProject Framework is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of the License,
+ * or (at your option) any later version.
+ * 
+ * The NuriaProject Framework is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with The NuriaProject Framework.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYMBOLTABLE_HPP
+#define SYMBOLTABLE_HPP
+
+#include <QByteArray>
+#include <QString>
+#include <QHash>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ * Interned string. A symbol is a 32-bit id into the SymbolTable, so copying
+ * and comparing symbols for equality is an integer operation. Each distinct
+ * string is stored once, in UTF-8. Ordering is lexicographic, like that of
+ * the strings. The empty string is always symbol 0.
+ */
+class Symbol {
+public:
+	
+	Symbol () = default;
+	
+	/** Interns \a string. */
+	Symbol (const QString &string);
+	Symbol (const char *string);
+	
+	/** Returns the symbol with \a id. */
+	static Symbol fromId (quint32 id);
+	
+	quint32 id () const
+	{ return this->m_id; }
+	
+	bool isEmpty () const
+	{ return this->m_id == 0; }
+	
+	/** Returns the string, in UTF-8. The data is valid for the whole run. */
+	const char *data () const;
+	int length () const;
+	
+	/** Returns the UTF-8 string without copying it. */
+	QByteArray utf8 () const;
+	QString toString () const;
+	
+	bool operator== (const Symbol &other) const
+	{ return this->m_id == other.m_id; }
+	
+	bool operator!= (const Symbol &other) const
+	{ return this->m_id != other.m_id; }
+	
+	bool operator< (const Symbol &other) const;
+	
+private:
+	quint32 m_id = 0;
+	
+};
+
+inline uint qHash (const Symbol &symbol, uint seed = 0)
+{ return qHash (symbol.id (), seed); }
+
+/**
+ * Process-wide table of interned strings. Strings are stored in fixed-size
+ * blocks which never move, so data returned for a symbol stays valid. Interning
+ * is thread-safe, looking up a symbol is lock-free.
+ */
+class SymbolTable {
+public:
+	
+	/** Returns the table used by all symbols. */
+	static SymbolTable *instance ();
+	
+	/** Returns the symbol of \a data, adding it if it's new. */
+	quint32 intern (const char *data, int length);
+	
+	/** Returns the string of symbol \a id. */
+	const char *data (quint32 id) const;
+	int length (quint32 id) const;
+	
+	/** Returns the count of symbols, and the bytes used to store them. */
+	int count () const;
+	qint64 size () const;
+	
+private:
+	SymbolTable ();
+	~SymbolTable ();
+	
+	struct Entry {
+		const char *data;
+		int length;
+	};
+	
+	enum {
+		EntriesPerChunk = 4096,
+		MaxChunks = 16384,
+		BlockSize = 64 * 1024
+	};
+	
+	const Entry &entry (quint32 id) const;
+	const char *store (const char *data, int length);
+	
+	std::mutex m_mutex;
+	QHash< QByteArray, quint32 > m_ids;
+	std::atomic< Entry * > m_chunks[MaxChunks];
+	std::atomic< int > m_count;
+	
+	// Arena of NUL-terminated strings
+	std::vector< char * > m_blocks;
+	int m_blockUsed = BlockSize;
+	qint64 m_size = 0;
+	
+};
+
+#endif // SYMBOLTABLE_HPP
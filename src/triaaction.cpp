@@ -17,8 +17,11 @@
 #include "triaaction.hpp"
 
 #include <clang/Frontend/CompilerInstance.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/AST/ASTContext.h>
 #include <llvm/Support/CommandLine.h>
 #include <clang/Lex/Preprocessor.h>
+#include <clang/Lex/Lexer.h>
 #include <clang/Basic/FileManager.h>
 #include <clang/Basic/Version.h>
 
@@ -27,6 +30,7 @@
 
 #include <QString>
 #include <QDebug>
+#include <QFile>
 #include <QTime>
 
 #ifdef Q_OS_UNIX
@@ -46,6 +50,8 @@ cl::opt< bool > argVerboseTimes ("verbose-times", cl::ValueDisallowed,
                                  cl::desc ("Print detailed timings of all processed input files"));
 cl::opt< std::string > argGlobalClass ("global-class", cl::value_desc ("class name"),
                                        cl::desc ("Fake class to put globals (methods, enums) into"));
+cl::opt< bool > argPrescan ("prescan", cl::ValueDisallowed,
+                            cl::desc ("Skip parsing inputs which don't use any NURIA_ macro directly"));
 
 // Aliases
 cl::alias aliasInspectBases ("B", cl::Prefix, cl::desc ("Alias for -introspect-inheriting"),
@@ -57,6 +63,132 @@ TriaAction::TriaAction (Definitions *definitions)
         : m_definitions (definitions)
 { }
 
+void TriaAction::setDefinitions (Definitions *definitions) {
+	this->m_definitions = definitions;
+}
+
+Definitions *TriaAction::definitions () const {
+	return this->m_definitions;
+}
+
+void TriaAction::configureLangOpts (clang::CompilerInstance &ci) {
+	ci.getFrontendOpts().SkipFunctionBodies = true;
+	ci.getLangOpts().DelayedTemplateParsing = true;
+	
+	// Enable everything for code compatibility
+	ci.getLangOpts().MicrosoftExt = true;
+	ci.getLangOpts().DollarIdents = true;
+	ci.getLangOpts().CPlusPlus11 = true;
+	ci.getLangOpts().GNUMode = true;
+	
+#if CLANG_VERSION_MINOR < 6
+	ci.getLangOpts().CPlusPlus1y = true;
+#else
+	ci.getLangOpts().CPlusPlus14 = true;
+#endif
+
+}
+
+QByteArray TriaAction::optionFingerprint () {
+	QByteArray result (argInspectAll ? "all;" : ";");
+	
+	for (const std::string &cur : argInspectBases) {
+		result.append (cur.c_str (), cur.length ());
+		result.append (',');
+	}
+	
+	result.append (';');
+	result.append (argGlobalClass.c_str (), argGlobalClass.length ());
+	return result;
+}
+
+// Annotation macros of the NuriaProject framework
+static const char *annotationMacros[] = {
+	"NURIA_INTROSPECT", "NURIA_ANNOTATE", "NURIA_READ", "NURIA_WRITE", "NURIA_REQUIRE", nullptr
+};
+
+static bool isAnnotationMacro (const llvm::StringRef &name) {
+	for (int i = 0; annotationMacros[i]; i++) {
+		if (name == annotationMacros[i]) {
+			return true;
+		}
+		
+	}
+	
+	return false;
+}
+
+static bool fileMayIntrospect (const QString &path, bool checkBases) {
+	QFile file (path);
+	if (!file.open (QIODevice::ReadOnly)) {
+		return true; // Let the actual run report it
+	}
+	
+	// The lexer needs a null-terminated buffer, which QByteArray is.
+	QByteArray data = file.readAll ();
+	const char *begin = data.constData ();
+	
+	clang::LangOptions langOpts;
+	langOpts.CPlusPlus = true;
+	langOpts.CPlusPlus11 = true;
+	
+	clang::Lexer lexer (clang::SourceLocation (), langOpts, begin, begin, begin + data.length ());
+	clang::Token token;
+	bool inClassHead = false;
+	
+	do {
+		lexer.LexFromRawLexer (token);
+		
+		if (token.is (clang::tok::raw_identifier)) {
+#if CLANG_VERSION_MINOR < 5
+			llvm::StringRef name (token.getRawIdentifierData (), token.getLength ());
+#else
+			llvm::StringRef name = token.getRawIdentifier ();
+#endif
+
+			if (isAnnotationMacro (name)) {
+				return true;
+			} else if (name == "class" || name == "struct") {
+				inClassHead = true;
+			}
+			
+		} else if (token.is (clang::tok::string_literal)) {
+			// __attribute__((annotate("nuria_...")))
+			llvm::StringRef literal (token.getLiteralData (), token.getLength ());
+			if (literal.find ("nuria_") != llvm::StringRef::npos) {
+				return true;
+			}
+			
+		} else if (checkBases && inClassHead && token.is (clang::tok::colon)) {
+			// A base may inherit an introspected class, which only
+			// parsing can tell.
+			return true;
+			
+		} else if (token.is (clang::tok::l_brace) || token.is (clang::tok::semi)) {
+			inClassHead = false;
+		}
+		
+	} while (token.isNot (clang::tok::eof));
+	
+	return false;
+}
+
+bool TriaAction::mayIntrospect (const QStringList &files) {
+	if (!argPrescan || argInspectAll) {
+		return true;
+	}
+	
+	bool checkBases = (argInspectBases.getNumOccurrences () > 0);
+	for (const QString &cur : files) {
+		if (fileMayIntrospect (cur, checkBases)) {
+			return true;
+		}
+		
+	}
+	
+	return false;
+}
+
 static QByteArray sourceFileName (const QStringList &files) {
 	if (files.length () == 1) {
 		return files.first ().toLatin1 ();
@@ -76,21 +208,8 @@ static QByteArray sourceFileName (const QStringList &files) {
 
 TriaAction::CreateAstConsumerResultType TriaAction::CreateASTConsumer (clang::CompilerInstance &ci,
                                                                        llvm::StringRef fileName) {
-	ci.getFrontendOpts().SkipFunctionBodies = true;
 	ci.getPreprocessor().enableIncrementalProcessing (true);
-	ci.getLangOpts().DelayedTemplateParsing = true;
-	
-	// Enable everything for code compatibility
-	ci.getLangOpts().MicrosoftExt = true;
-	ci.getLangOpts().DollarIdents = true;
-	ci.getLangOpts().CPlusPlus11 = true;
-	ci.getLangOpts().GNUMode = true;
-	
-#if CLANG_VERSION_MINOR < 6
-	ci.getLangOpts().CPlusPlus1y = true;
-#else
-	ci.getLangOpts().CPlusPlus14 = true;
-#endif
+	configureLangOpts (ci);
 	
 	if (argVerboseTimes) {
 		UNIQUE_COMPAT(PreprocessorHooks, hook, new PreprocessorHooks (ci));
@@ -100,14 +219,7 @@ TriaAction::CreateAstConsumerResultType TriaAction::CreateASTConsumer (clang::Co
 	}
 	
 	// 
-	QStringList whichInherit;
-	for (const std::string &cur : argInspectBases) {
-		whichInherit.append (QString::fromStdString (cur));
-	}
-	
-	// 
-	TriaASTConsumer *consumer = new TriaASTConsumer (ci, fileName, whichInherit, argInspectAll,
-	                                                 argGlobalClass, this->m_definitions);
+	clang::ASTConsumer *consumer = createConsumer (ci, fileName);
 	
 #if CLANG_VERSION_MINOR < 6
 	return consumer;
@@ -116,6 +228,78 @@ TriaAction::CreateAstConsumerResultType TriaAction::CreateASTConsumer (clang::Co
 #endif
 }
 
+clang::ASTConsumer *TriaAction::createConsumer (clang::CompilerInstance &ci, llvm::StringRef fileName) {
+	QStringList whichInherit;
+	for (const std::string &cur : argInspectBases) {
+		whichInherit.append (QString::fromStdString (cur));
+	}
+	
+	return new TriaASTConsumer (ci, fileName, whichInherit, argInspectAll,
+	                            argGlobalClass, this->m_definitions);
+}
+
+// Passes the tag definitions in \a decl to \a consumer. Like Sema, inner
+// definitions are passed before the outer one.
+static void consumeTagDefinitions (clang::ASTConsumer &consumer, clang::Decl *decl) {
+	if (decl->isImplicit ()) {
+		return;
+	}
+	
+	// Class templates and their specializations
+	if (clang::ClassTemplateDecl *templ = llvm::dyn_cast< clang::ClassTemplateDecl > (decl)) {
+		consumeTagDefinitions (consumer, templ->getTemplatedDecl ());
+		for (auto it = templ->spec_begin (), end = templ->spec_end (); it != end; ++it) {
+			if ((*it)->getSpecializationKind () == clang::TSK_ImplicitInstantiation) {
+				consumeTagDefinitions (consumer, *it);
+			}
+			
+		}
+		
+		return;
+	}
+	
+	// Walk into namespaces, extern "C" blocks and records
+	clang::DeclContext *context = llvm::dyn_cast< clang::DeclContext > (decl);
+	if (context && (llvm::isa< clang::NamespaceDecl > (decl) || llvm::isa< clang::LinkageSpecDecl > (decl) ||
+	                llvm::isa< clang::TagDecl > (decl))) {
+		for (auto it = context->decls_begin (), end = context->decls_end (); it != end; ++it) {
+			consumeTagDefinitions (consumer, *it);
+		}
+		
+	}
+	
+	clang::TagDecl *tag = llvm::dyn_cast< clang::TagDecl > (decl);
+	if (tag && tag->isCompleteDefinition ()) {
+		consumer.HandleTagDeclDefinition (tag);
+	}
+	
+}
+
+void TriaAction::consumeAst (clang::CompilerInstance &ci) {
+	clang::ASTContext &context = ci.getASTContext ();
+	clang::SourceManager &sm = ci.getSourceManager ();
+	const clang::FileEntry *mainFile = nullptr;
+	if (!sm.getMainFileID ().isInvalid ()) {
+		mainFile = sm.getFileEntryForID (sm.getMainFileID ());
+	}
+	
+	std::unique_ptr< clang::ASTConsumer > consumer (createConsumer (ci, mainFile ? mainFile->getName () : ""));
+	
+	// Top-level declarations are deserialized on demand while iterating
+	clang::TranslationUnitDecl *unit = context.getTranslationUnitDecl ();
+	consumer->Initialize (context);
+	
+	for (auto it = unit->decls_begin (), end = unit->decls_end (); it != end; ++it) {
+		if (!(*it)->isImplicit ()) {
+			consumeTagDefinitions (*consumer, *it);
+			consumer->HandleTopLevelDecl (clang::DeclGroupRef (*it));
+		}
+		
+	}
+	
+	consumer->HandleTranslationUnit (context);
+}
+
 static inline qint64 nowUsec () {
 #ifdef Q_OS_UNIX
 	timeval tv;
@@ -20,6 +20,7 @@
 #include <clang/Frontend/FrontendAction.h>
 #include <clang/Lex/PPCallbacks.h>
 #include <clang/Basic/Version.h>
+#include <QStringList>
 #include <QByteArray>
 #include <QVector>
 
@@ -60,6 +61,41 @@ public:
 	
 	TriaAction (Definitions *definitions);
 	
+	/** Sets the definitions the next run will write into. */
+	void setDefinitions (Definitions *definitions);
+	
+	/** Returns the definitions the next run will write into. */
+	Definitions *definitions () const;
+	
+	/**
+	 * Applies the language options tria parses with to \a ci. Anything
+	 * parsing code for tria, like a precompiled header, must use these.
+	 */
+	static void configureLangOpts (clang::CompilerInstance &ci);
+	
+	/**
+	 * Returns the tria options which influence what is gathered from the
+	 * input, for use in cache keys.
+	 */
+	static QByteArray optionFingerprint ();
+	
+	/**
+	 * Scans \a files with the raw lexer for anything which could be
+	 * introspected with the current options: Uses of the NURIA_ annotation
+	 * macros, or annotate attributes. If a base list is given, any class
+	 * with bases may match. Returns \c false if none of the files contain
+	 * such things, and thus parsing them wouldn't find anything. Only done
+	 * with --prescan, as macros wrapping the annotations can't be seen.
+	 */
+	static bool mayIntrospect (const QStringList &files);
+	
+	/**
+	 * Passes all declarations of the AST loaded into \a ci to the AST
+	 * consumer, in the order the parser would have. Used to read
+	 * pre-built AST files instead of parsing.
+	 */
+	void consumeAst (clang::CompilerInstance &ci);
+	
 protected:
 	
 #if CLANG_VERSION_MINOR < 6
@@ -72,6 +108,8 @@ protected:
 	                                                       llvm::StringRef fileName) override;
 	
 private:
+	clang::ASTConsumer *createConsumer (clang::CompilerInstance &ci, llvm::StringRef fileName);
+	
 	Definitions *m_definitions;
 	
 };
@@ -18,6 +18,7 @@
 
 #include <clang/AST/DeclTemplate.h>
 #include <clang/AST/ASTContext.h>
+#include <clang/Basic/FileManager.h>
 #include <clang/Basic/Version.h>
 #include <clang/AST/DeclCXX.h>
 #include <clang/AST/Attr.h>
@@ -36,6 +37,10 @@ static const QString skipAnnotation = QStringLiteral ("nuria_skip");
 static const QString readAnnotation = QStringLiteral ("nuria_read:");
 static const QString writeAnnotation = QStringLiteral ("nuria_write:");
 static const QString requireAnnotation = QStringLiteral ("nuria_require:");
+static const Symbol introspectSymbol (introspectAnnotation);
+static const Symbol skipSymbol (skipAnnotation);
+static const Symbol voidSymbol ("void");
+static const Symbol boolSymbol ("_Bool");
 
 TriaASTConsumer::TriaASTConsumer (clang::CompilerInstance &compiler, const llvm::StringRef &fileName,
 				  const QStringList &introspectBases, bool introspectAll,
@@ -53,9 +58,21 @@ TriaASTConsumer::TriaASTConsumer (clang::CompilerInstance &compiler, const llvm:
 
 void TriaASTConsumer::Initialize (clang::ASTContext &ctx) {
 	this->m_context = &ctx;
+	this->m_sourceFiles = this->m_definitions->sourceFiles ();
+	
+	// Resolve the inputs once, so declarations are matched by their file
+	clang::FileManager &fm = this->m_compiler.getFileManager ();
+	for (const QString &cur : this->m_sourceFiles) {
+		const clang::FileEntry *entry = fm.getFile (cur.toStdString ());
+		if (entry) {
+			this->m_inputFiles.insert (entry);
+		}
+		
+	}
+	
 }
 
-static bool containsAnnotation (const Annotations &list, const QString &name) {
+static bool containsAnnotation (const Annotations &list, const Symbol &name) {
 	for (const AnnotationDef &cur : list) {
 		if (cur.name == name) {
 			return true;
@@ -154,34 +171,69 @@ AnnotationDef TriaASTConsumer::parseNuriaAnnotate (const QString &data) {
 	return def;
 }
 
+TriaASTConsumer::RecordInfo &TriaASTConsumer::recordInfo (const clang::CXXRecordDecl *record) {
+	auto it = this->m_records.find (record);
+	if (it == this->m_records.end ()) {
+		it = this->m_records.insert (record, RecordInfo ());
+		it->isAbstract = record->hasDefinition () && record->isAbstract ();
+	}
+	
+	return *it;
+}
+
 bool TriaASTConsumer::derivesFromIntrospectClass (const clang::CXXRecordDecl *record) {
 	if (!record || this->m_introspectedBases.isEmpty ()) {
 		return false;
 	}
 	
-	if (this->m_introspectedBases.contains (typeDeclName (record))) {
-		return true;
-	}
-	
-	for (auto it = record->bases_begin (); it != record->bases_end (); ++it) {
-		const clang::CXXBaseSpecifier &specifier = *it;
-		const clang::Type *type = specifier.getType ().getTypePtr ();
-		
-		if (this->m_introspectedBases.contains (typeName (type))) {
-			return true;
+	RecordInfo &info = recordInfo (record);
+	if (info.derivesFromIntrospectClass != RecordInfo::Unknown) {
+		return info.derivesFromIntrospectClass;
+	}
+	
+	// Walk all bases once, even in diamond hierarchies. Bases with a known
+	// result needn't be walked again.
+	bool derives = this->m_introspectedBases.contains (typeDeclName (record));
+	QSet< const clang::CXXRecordDecl * > visited { record };
+	QVector< const clang::CXXRecordDecl * > pending { record };
+	
+	while (!derives && !pending.isEmpty ()) {
+		const clang::CXXRecordDecl *cur = pending.takeLast ();
+		for (auto it = cur->bases_begin (); !derives && it != cur->bases_end (); ++it) {
+			const clang::Type *type = it->getType ().getTypePtr ();
+			const clang::CXXRecordDecl *decl = type->getAsCXXRecordDecl ();
+			derives = this->m_introspectedBases.contains (typeName (type));
+			
+			if (derives || !decl || visited.contains (decl)) {
+				continue;
+			}
+			
+			// 
+			visited.insert (decl);
+			auto known = this->m_records.constFind (decl);
+			if (known != this->m_records.constEnd () && known->derivesFromIntrospectClass != RecordInfo::Unknown) {
+				derives = known->derivesFromIntrospectClass;
+			} else if (this->m_introspectedBases.contains (typeDeclName (decl))) {
+				derives = true;
+			} else {
+				pending.append (decl);
+			}
+			
 		}
 		
-		// 
-		const clang::CXXRecordDecl *decl = type->getAsCXXRecordDecl ();
-		if (decl && derivesFromIntrospectClass (decl)) {
-			return true;
+	}
+	
+	// Bases visited in a negative search don't derive either
+	if (!derives) {
+		for (const clang::CXXRecordDecl *cur : visited) {
+			recordInfo (cur).derivesFromIntrospectClass = false;
 		}
 		
 	}
 	
-	// 
-	return false;
-	
+	// The reference may have been invalidated by the loop above
+	recordInfo (record).derivesFromIntrospectClass = derives;
+	return derives;
 }
 
 Annotations TriaASTConsumer::annotationsFromDecl (clang::Decl *decl) {
@@ -226,6 +278,19 @@ static inline QString llvmToString (const llvm::StringRef &str) {
 }
 
 QString TriaASTConsumer::typeDeclName (const clang::NamedDecl *decl) {
+	this->m_typeNameLookups++;
+	auto it = this->m_declNames.constFind (decl);
+	if (it != this->m_declNames.constEnd ()) {
+		this->m_typeNameHits++;
+		return *it;
+	}
+	
+	QString name = buildTypeDeclName (decl);
+	this->m_declNames.insert (decl, name);
+	return name;
+}
+
+QString TriaASTConsumer::buildTypeDeclName (const clang::NamedDecl *decl) {
 	const clang::ClassTemplateSpecializationDecl *templ =
 			llvm::dyn_cast< clang::ClassTemplateSpecializationDecl > (decl);
 	QString name = QString::fromStdString (decl->getQualifiedNameAsString ());
@@ -261,6 +326,19 @@ QString TriaASTConsumer::typeDeclName (const clang::NamedDecl *decl) {
 }
 
 QString TriaASTConsumer::typeName (const clang::Type *type) {
+	this->m_typeNameLookups++;
+	auto it = this->m_typeNames.constFind (type);
+	if (it != this->m_typeNames.constEnd ()) {
+		this->m_typeNameHits++;
+		return *it;
+	}
+	
+	QString name = buildTypeName (type);
+	this->m_typeNames.insert (type, name);
+	return name;
+}
+
+QString TriaASTConsumer::buildTypeName (const clang::Type *type) {
 	const clang::CXXRecordDecl *decl = type->getAsCXXRecordDecl ();
 	const clang::TypedefType *typeDef = type->getAs< clang::TypedefType > ();
 	
@@ -324,6 +402,25 @@ QString TriaASTConsumer::fileOfDecl (clang::Decl *decl) {
 	return this->m_pathCache.value (fileId);
 }
 
+bool TriaASTConsumer::isInputFile (clang::Decl *decl) {
+	clang::SourceManager &mgr = this->m_compiler.getSourceManager ();
+	clang::SourceLocation location = mgr.getExpansionLoc (decl->getSourceRange ().getBegin ());
+	clang::FileID fileId = mgr.getFileID (location);
+	
+	auto it = this->m_inputFileIds.constFind (fileId.getHashValue ());
+	if (it != this->m_inputFileIds.constEnd ()) {
+		return *it;
+	}
+	
+	// Fall back to the path for inputs the file manager didn't know
+	const clang::FileEntry *entry = mgr.getFileEntryForID (fileId);
+	bool isInput = (entry && (this->m_inputFiles.contains (entry) ||
+	                          this->m_sourceFiles.contains (fileOfDecl (decl))));
+	
+	this->m_inputFileIds.insert (fileId.getHashValue (), isInput);
+	return isInput;
+}
+
 bool TriaASTConsumer::hasRecordValueSemantics (const clang::CXXRecordDecl *record, bool abstractTest) {
 	record = (!record || record->isThisDeclarationADefinition ()) ? record : record->getDefinition ();
 	
@@ -332,8 +429,19 @@ bool TriaASTConsumer::hasRecordValueSemantics (const clang::CXXRecordDecl *recor
 		return true;
 	}
 	
-	// 
-	if ((abstractTest && record->isAbstract ()) || isDeclATemplate (record)) {
+	// The abstract test is done on top of the cached result
+	RecordInfo &info = recordInfo (record);
+	if (info.valueSemantics == RecordInfo::Unknown) {
+		bool valueSemantics = computeValueSemantics (record);
+		recordInfo (record).valueSemantics = valueSemantics;
+		return valueSemantics && !(abstractTest && recordInfo (record).isAbstract);
+	}
+	
+	return info.valueSemantics && !(abstractTest && info.isAbstract);
+}
+
+bool TriaASTConsumer::computeValueSemantics (const clang::CXXRecordDecl *record) {
+	if (isDeclATemplate (record)) {
 		return false;
 	}
 	
@@ -390,7 +498,7 @@ bool TriaASTConsumer::hasTypeValueSemantics (const clang::QualType &type) {
 }
 
 bool TriaASTConsumer::shouldIntrospect (const Annotations &annotations, bool isGlobal, clang::CXXRecordDecl *record) {
-	if (containsAnnotation (annotations, skipAnnotation)) {
+	if (containsAnnotation (annotations, skipSymbol)) {
 		return false;
 	}
 	
@@ -399,10 +507,57 @@ bool TriaASTConsumer::shouldIntrospect (const Annotations &annotations, bool isG
 	}
 	
 	return (!isGlobal ||
-	        containsAnnotation (annotations, introspectAnnotation) ||
+	        containsAnnotation (annotations, introspectSymbol) ||
 	        derivesFromIntrospectClass (record));
 }
 
+void TriaASTConsumer::checkReferencedType (const clang::QualType &type) {
+	clang::CXXRecordDecl *record = type.getNonReferenceType ().getTypePtr ()->getAsCXXRecordDecl ();
+	if (!record || this->m_checkedRecords.contains (record->getCanonicalDecl ())) {
+		return;
+	}
+	
+	// Not defined yet, check it once it is.
+	if (!record->getDefinition ()) {
+		this->m_pendingRecords.insert (record->getCanonicalDecl ());
+		return;
+	}
+	
+	avoidForeignRecord (record->getDefinition ());
+}
+
+void TriaASTConsumer::avoidForeignRecord (clang::CXXRecordDecl *record) {
+	this->m_checkedRecords.insert (record->getCanonicalDecl ());
+	this->m_pendingRecords.remove (record->getCanonicalDecl ());
+	if (isInputFile (record)) {
+		return;
+	}
+	
+	// Same as processClass() would do for a type of the input
+	if (!hasTypeValueSemantics (record->getTypeForDecl ())) {
+		this->m_definitions->avoidType (typeName (record->getTypeForDecl ()));
+		if (!isDeclATemplate (record) && shouldIntrospect (annotationsFromDecl (record), true, record)) {
+			this->m_definitions->avoidType (typeDeclName (record));
+		}
+		
+		return;
+	}
+	
+	if (isDeclATemplate (record) || !shouldIntrospect (annotationsFromDecl (record), true, record)) {
+		return;
+	}
+	
+	bool hasDefaultCtor = record->hasDefaultConstructor () || record->hasUserProvidedDefaultConstructor ();
+	bool hasCopyCtor = record->hasCopyConstructorWithConstParam () || record->hasUserDeclaredCopyConstructor ();
+	bool hasAssignmentOperator = record->hasCopyAssignmentWithConstParam () ||
+	                             record->hasUserDeclaredCopyAssignment ();
+	
+	if (!hasDefaultCtor || !hasCopyCtor || !hasAssignmentOperator) {
+		this->m_definitions->avoidType (typeDeclName (record));
+	}
+	
+}
+
 BaseDef TriaASTConsumer::processBase (clang::CXXBaseSpecifier *specifier) {
 	BaseDef base;
 	
@@ -414,7 +569,7 @@ BaseDef TriaASTConsumer::processBase (clang::CXXBaseSpecifier *specifier) {
 	return base;
 }
 
-static int findField (ClassDef &classDef, const QString &name) {
+static int findField (ClassDef &classDef, const Symbol &name) {
 	for (int i = 0; i < classDef.variables.length (); i++) {
 		if (classDef.variables.at (i).name == name) {
 			return i;
@@ -431,13 +586,13 @@ bool TriaASTConsumer::registerReadWriteMethod (ClassDef &classDef, MethodDef &de
 	QString fieldName;
 	
 	for (int i = 0; i < def.annotations.length (); i++) {
-		const AnnotationDef &cur = def.annotations.at (i);
+		QString name = def.annotations.at (i).name.toString ();
 		
-		if (cur.name.startsWith (readAnnotation)) {
-			fieldName = cur.name.mid (readAnnotation.length ());
+		if (name.startsWith (readAnnotation)) {
+			fieldName = name.mid (readAnnotation.length ());
 			canRead = true;
-		} else if (cur.name.startsWith (writeAnnotation)) {
-			fieldName = cur.name.mid (writeAnnotation.length ());
+		} else if (name.startsWith (writeAnnotation)) {
+			fieldName = name.mid (writeAnnotation.length ());
 			canWrite = true;
 		} else {
 			continue;
@@ -510,7 +665,7 @@ bool TriaASTConsumer::registerReadWriteMethod (ClassDef &classDef, MethodDef &de
 		} else if (!field.setter.isEmpty ()) {
 			reportWarning (decl->getLocation (),
 				       "Multiple registered NURIA_WRITE methods for this field.");
-		} else if (def.returnType.type != "void" && def.returnType.type != "_Bool") {
+		} else if (def.returnType.type != voidSymbol && def.returnType.type != boolSymbol) {
 			reportWarning (decl->getLocation (),
 				       "A NURIA_WRITE method should return void or bool.");
 		}
@@ -523,7 +678,7 @@ bool TriaASTConsumer::registerReadWriteMethod (ClassDef &classDef, MethodDef &de
 	} else {
 		field.setter = def.name;
 		field.setterArgName = def.arguments.at (0).name;
-		field.setterReturnsBool = (def.returnType.type == "_Bool");
+		field.setterReturnsBool = (def.returnType.type == boolSymbol);
 	}
 	
 	return true;
@@ -545,6 +700,7 @@ void TriaASTConsumer::fillVariableDef (VariableDef &def, const clang::QualType &
 	}
 	
 	// 
+	checkReferencedType (type);
 	def.type = typeName (type);
 	def.isReference = type.getTypePtr ()->isReferenceType ();
 	def.isConst |= type.isConstant (*this->m_context) || type.isConstQualified () ||
@@ -584,10 +740,10 @@ void TriaASTConsumer::processMethod (ClassDef &classDef, clang::FunctionDecl *de
 	// Skip non-public methods. skipped methods and methods which are default-implemented
 	bool resultTypeHasValueSemantics = hasTypeValueSemantics (getMethodResultType (decl));
 	if (def.access != clang::AS_public || decl->isDefaulted () || decl->isDeleted () ||
-	    !resultTypeHasValueSemantics || containsAnnotation (def.annotations, skipAnnotation)) {
+	    !resultTypeHasValueSemantics || containsAnnotation (def.annotations, skipSymbol)) {
 		
 		if (!resultTypeHasValueSemantics) {
-			this->m_definitions->avoidType (def.returnType.type);
+			this->m_definitions->avoidType (def.returnType.type.toString ());
 		}
 		
 		return;
@@ -645,7 +801,7 @@ void TriaASTConsumer::processMethod (ClassDef &classDef, clang::FunctionDecl *de
 		if (!hasTypeValueSemantics (param->getType ()) ||
 		    (typeRec && typeRec->getAccess () != clang::AS_public &&
 		     typeRec->getAccess () != clang::AS_none)) {
-			this->m_definitions->avoidType (var.type);
+			this->m_definitions->avoidType (var.type.toString ());
 			return;
 		}
 		
@@ -668,8 +824,8 @@ void TriaASTConsumer::processMethod (ClassDef &classDef, clang::FunctionDecl *de
 	// Final check if this is a conversion method
 	if (method && canConvert && 
 	    (def.type == ConstructorMethod ||
-	     (def.type == StaticMethod && def.name.startsWith (fromMethod)) ||
-	     (def.type == MemberMethod && !hasMandatoryArgument && def.name.startsWith (toMethod)))) {
+	     (def.type == StaticMethod && def.name.toString ().startsWith (fromMethod)) ||
+	     (def.type == MemberMethod && !hasMandatoryArgument && def.name.toString ().startsWith (toMethod)))) {
 		ConversionDef conv;
 		conv.methodName = def.name;
 		conv.type = def.type;
@@ -704,20 +860,22 @@ VariableDef TriaASTConsumer::processVariable (clang::FieldDecl *decl) {
 	
 	def.loc = decl->getSourceRange ();
 	def.access = (decl->getAccess () == clang::AS_none) ? clang::AS_public : decl->getAccess ();
-	def.type = typeName (decl->getType ());
 	def.name = llvmToString (decl->getName ());
 	def.annotations = annotationsFromDecl (decl);
 	def.isPodType = decl->getType ().isPODType (*this->m_context);
 
 	if (def.access != clang::AS_public) {
+		def.type = typeName (decl->getType ());
 		return def;
 	}
 	
+	checkReferencedType (decl->getType ());
+	def.type = typeName (decl->getType ());
 	if (hasTypeValueSemantics (decl->getType ())) {
 		declareType (decl->getType ());
 	} else {
 		reportWarning (decl->getLocation (), "Type of variable doesn't have value-semantics, skipping.");
-		this->m_definitions->avoidType (def.type);
+		this->m_definitions->avoidType (def.type.toString ());
 	}
 	
 	return def;
@@ -755,12 +913,13 @@ void TriaASTConsumer::processEnum (ClassDef &classDef, clang::EnumDecl *decl, bo
 }
 
 void TriaASTConsumer::processConversion (ClassDef &classDef, clang::CXXConversionDecl *convDecl) {
+	checkReferencedType (convDecl->getConversionType ());
 	if (!hasTypeValueSemantics (convDecl->getConversionType ())) {
 		return;
 	}
 	
 	// Make sure this isn't NURIA_SKIP'd
-	if (containsAnnotation (annotationsFromDecl (convDecl), skipAnnotation)) {
+	if (containsAnnotation (annotationsFromDecl (convDecl), skipSymbol)) {
 		return;
 	}
 	
@@ -770,7 +929,7 @@ void TriaASTConsumer::processConversion (ClassDef &classDef, clang::CXXConversio
 	conv.isConst = convDecl->isConst ();
 	conv.fromType = classDef.name;
 	conv.toType = typeName (convDecl->getConversionType ());
-	conv.methodName = QStringLiteral ("operator ") + conv.toType;
+	conv.methodName = QStringLiteral ("operator ") + conv.toType.toString ();
 	
 	declareType (convDecl->getConversionType ());
 	classDef.conversions.append (conv);
@@ -784,6 +943,16 @@ void TriaASTConsumer::HandleTagDeclDefinition (clang::TagDecl *decl) {
 		return;
 	}
 	
+	// Types of other files are only looked at once an introspected type
+	// uses them, see checkReferencedType().
+	if (record && !isInputFile (record)) {
+		if (!processMetaTypeId (record) && this->m_pendingRecords.contains (record->getCanonicalDecl ())) {
+			avoidForeignRecord (record);
+		}
+		
+		return;
+	}
+	
 	// 
 	if (record) {
 		processClass (record);
@@ -795,7 +964,7 @@ void TriaASTConsumer::HandleTagDeclDefinition (clang::TagDecl *decl) {
 
 bool TriaASTConsumer::HandleTopLevelDecl (clang::DeclGroupRef groupRef) {
 	for (auto it = groupRef.begin (), end = groupRef.end (); it != end; ++it) {
-		if (!this->m_definitions->sourceFiles ().contains (fileOfDecl (*it))) {
+		if (!isInputFile (*it)) {
 			continue;
 		}
 		
@@ -809,6 +978,8 @@ bool TriaASTConsumer::HandleTopLevelDecl (clang::DeclGroupRef groupRef) {
 }
 
 void TriaASTConsumer::HandleTranslationUnit (clang::ASTContext &) {
+	this->m_definitions->addTypeNameStats (this->m_typeNameLookups, this->m_typeNameHits);
+	
 	if (!this->m_globals.name.isEmpty () &&
 	    (!this->m_globals.enums.isEmpty () ||
 	     !this->m_globals.methods.isEmpty ())) {
@@ -843,19 +1014,27 @@ bool TriaASTConsumer::isDeclUnnamed (const clang::DeclContext *decl) {
 	return false;
 }
 
-void TriaASTConsumer::processClass (clang::CXXRecordDecl *record) {
+bool TriaASTConsumer::processMetaTypeId (clang::CXXRecordDecl *record) {
 	static const llvm::StringRef qMetaTypeIdName ("QMetaTypeId");
 	
 	// Check if this is a QMetaTypeId specialization (Result of a Q_DECLARE_METATYPE)
 	clang::ClassTemplateSpecializationDecl *templ = llvm::dyn_cast< clang::ClassTemplateSpecializationDecl > (record);
 	
-	if (templ && templ->getName () == qMetaTypeIdName) {
-		const clang::TemplateArgumentList &list = templ->getTemplateArgs ();
-		if (list.size () == 1) {
-			QString name = typeName (list.get (0).getAsType ());
-			this->m_definitions->addDeclaredType (name);
-		}
-		
+	if (!templ || templ->getName () != qMetaTypeIdName) {
+		return false;
+	}
+	
+	const clang::TemplateArgumentList &list = templ->getTemplateArgs ();
+	if (list.size () == 1) {
+		QString name = typeName (list.get (0).getAsType ());
+		this->m_definitions->addDeclaredType (name);
+	}
+	
+	return true;
+}
+
+void TriaASTConsumer::processClass (clang::CXXRecordDecl *record) {
+	if (processMetaTypeId (record)) {
 		return;
 	}
 	
@@ -885,7 +1064,7 @@ void TriaASTConsumer::processClass (clang::CXXRecordDecl *record) {
 	
 	// Remove NURIA_INTROSPECT annotation from the list
 	for (auto it = classDef.annotations.begin (); it != classDef.annotations.end ();) {
-		if (it->name == introspectAnnotation) {
+		if (it->name == introspectSymbol) {
 			it = classDef.annotations.erase (it);
 		} else {
 			++it;
@@ -907,12 +1086,7 @@ void TriaASTConsumer::processClass (clang::CXXRecordDecl *record) {
 				     classDef.hasAssignmentOperator && typeHasValueSemantics;
 	
 	if (!classDef.hasValueSemantics) {
-		this->m_definitions->avoidType (classDef.name);
-	}
-	
-	// Ignore further information if the type isn't in the source file(s)
-	if (!this->m_definitions->sourceFiles ().contains (classDef.file)) {
-		return;
+		this->m_definitions->avoidType (classDef.name.toString ());
 	}
 	
 	// Parent classes
@@ -930,7 +1104,7 @@ void TriaASTConsumer::processClass (clang::CXXRecordDecl *record) {
 		VariableDef field = processVariable (*it);
 		
 		if (field.access == clang::AS_public &&
-		    !containsAnnotation (field.annotations, skipAnnotation)) {
+		    !containsAnnotation (field.annotations, skipSymbol)) {
 			classDef.variables.append (field);
 		}
 		
@@ -21,6 +21,8 @@
 #include <clang/AST/ASTConsumer.h>
 #include <clang/AST/Decl.h>
 #include <QStringList>
+#include <QHash>
+#include <QSet>
 
 #include "definitions.hpp"
 #undef bool
@@ -53,6 +55,16 @@ private:
 	QMetaType::Type typeOfAnnotationValue (const QString &valueData);
 	AnnotationDef parseNuriaAnnotate (const QString &data);
 	
+	// Cached analysis of a record
+	struct RecordInfo {
+		enum { Unknown = -1 };
+		
+		int valueSemantics = Unknown; // Ignoring abstractness
+		int derivesFromIntrospectClass = Unknown;
+		bool isAbstract = false;
+	};
+	
+	RecordInfo &recordInfo (const clang::CXXRecordDecl *record);
 	bool derivesFromIntrospectClass (const clang::CXXRecordDecl *record);
 	
 	void reportError (clang::SourceLocation loc, const QByteArray &info);
@@ -65,15 +77,22 @@ private:
 	void declareType (const clang::QualType &type);
 	
 	QString typeDeclName (const clang::NamedDecl *decl);
+	QString buildTypeDeclName (const clang::NamedDecl *decl);
 	QString typeName (const clang::Type *type);
+	QString buildTypeName (const clang::Type *type);
 	QString typeName (const clang::QualType &type);
 	QString fileOfDecl (clang::Decl *decl);
+	bool isInputFile (clang::Decl *decl);
 	
 	bool hasRecordValueSemantics (const clang::CXXRecordDecl *record, bool abstractTest = true);
+	bool computeValueSemantics (const clang::CXXRecordDecl *record);
 	bool hasTypeValueSemantics (const clang::QualType &type);
 	bool hasTypeValueSemantics (const clang::Type *type);
 	
 	bool shouldIntrospect (const Annotations &annotations, bool isGlobal, clang::CXXRecordDecl *record = nullptr);
+	void checkReferencedType (const clang::QualType &type);
+	void avoidForeignRecord (clang::CXXRecordDecl *record);
+	bool processMetaTypeId (clang::CXXRecordDecl *record);
 	void processClass (clang::CXXRecordDecl *record);
 	BaseDef processBase (clang::CXXBaseSpecifier *specifier);
 	bool registerReadWriteMethod (ClassDef &classDef, MethodDef &def, clang::CXXMethodDecl *decl);
@@ -85,6 +104,18 @@ private:
 	
 	// 
 	QMap< clang::FileID, QString > m_pathCache;
+	QHash< unsigned, bool > m_inputFileIds;
+	QSet< const clang::FileEntry * > m_inputFiles;
+	QSet< const clang::CXXRecordDecl * > m_checkedRecords;
+	QSet< const clang::CXXRecordDecl * > m_pendingRecords;
+	QStringList m_sourceFiles;
+	
+	// Type names are built once per type or declaration
+	QHash< const clang::Type *, QString > m_typeNames;
+	QHash< const clang::NamedDecl *, QString > m_declNames;
+	QHash< const clang::CXXRecordDecl *, RecordInfo > m_records;
+	int m_typeNameLookups = 0;
+	int m_typeNameHits = 0;
 	Definitions *m_definitions;
 	QStringList m_introspectedBases;
 	bool m_introspectAll;